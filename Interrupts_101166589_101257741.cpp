@@ -6,322 +6,323 @@
  */
 
 #include "Interrupts_101166589_101257741.hpp"
-#include <climits>
-
-
-
-std::tuple<std::string, std::string, int> simulate_trace(std::vector<std::string> trace_file, int time, std::vector<std::string> vectors, std::vector<int> delays, std::vector<external_file> external_files, PCB current, std::vector<PCB> wait_queue) {
-
-    std::string trace;      //!< string to store single line of trace file
-    std::string execution = "";  //!< string to accumulate the execution output
-    std::string system_status = "";  //!< string to accumulate the system status output
-    int current_time = time;
-
-    //parse each line of the input trace file. 'for' loop to keep track of indices.
-    for(size_t i = 0; i < trace_file.size(); i++) {
-        auto trace = trace_file[i];
-
-        auto [activity, duration_intr, program_name] = parse_trace(trace);
-
-        if(activity == "CPU") { //As per Assignment 1
-            execution += std::to_string(current_time) + ", " + std::to_string(duration_intr) + ", CPU Burst\n";
-            current_time += duration_intr;
-        } else if(activity == "SYSCALL") { //As per Assignment 1
-            auto [intr, time] = intr_boilerplate(current_time, duration_intr, 10, vectors);
-            execution += intr;
-            current_time = time;
-
-            execution += std::to_string(current_time) + ", " + std::to_string(delays[duration_intr]) + ", SYSCALL ISR (ADD STEPS HERE)\n";
-            current_time += delays[duration_intr];
-
-            execution +=  std::to_string(current_time) + ", 1, IRET\n";
-            current_time += 1;
-        } else if(activity == "END_IO") {
-            auto [intr, time] = intr_boilerplate(current_time, duration_intr, 10, vectors);
-            current_time = time;
-            execution += intr;
-
-            execution += std::to_string(current_time) + ", " + std::to_string(delays[duration_intr]) + ", ENDIO ISR(ADD STEPS HERE)\n";
-            current_time += delays[duration_intr];
-
-            execution +=  std::to_string(current_time) + ", 1, IRET\n";
-            current_time += 1;
-        } else if(activity == "FORK") {
-            auto [intr, time] = intr_boilerplate(current_time, 2, 10, vectors);
-            execution += intr;
-            current_time = time;
-
-            ///////////////////////////////////////////////////////////////////////////////////////////
-            //FORK implementation
-            
-            // Calculate next PID inline
-            unsigned int child_pid = 1;
-            for (const auto& pcb : wait_queue) {
-                if (pcb.PID >= child_pid) child_pid = pcb.PID + 1;
-            }
-            if (current.PID >= child_pid) child_pid = current.PID + 1;
-            
-            // Find available partition using BEST FIT algorithm
-            int child_partition = -1;
-            int best_fit_size = INT_MAX;
-            for(int j = 0; j < 6; j++) {
-                if(memory[j].code == "empty" && memory[j].size >= current.size) {
-                    int wasted_space = memory[j].size - current.size;
-                    if(wasted_space < best_fit_size) {
-                        best_fit_size = wasted_space;
-                        child_partition = memory[j].partition_number;
-                    }
-                }
-            }
-
-            // Declare child PCB outside if block so it's accessible later
-            PCB child(child_pid, current.PID, current.program_name, current.size, child_partition);
-
-            if(child_partition == -1) {
-                execution += std::to_string(current_time) + ", FORK ERROR: No available partition\n";
-            } else {
-                execution += std::to_string(current_time) + ", " + std::to_string(duration_intr) + ", cloning the PCB\n";
-                memory[child_partition - 1].code = current.program_name;
-                current_time += duration_intr;
-
-                execution += std::to_string(current_time) + ", 0, scheduler called\n";
-                execution += std::to_string(current_time) + ", 1, IRET\n";
-                current_time += 1;
-
-                ///////////////////////////////////////////////////////////////////////////////////////////
-                //SYSTEM STATUS for FORK (ADD STEPS HERE)
-                
-                // Build waiting processes list: parent first, then wait_queue
-                std::vector<PCB> fork_waiting_pcbs;
-                fork_waiting_pcbs.push_back(current);
-                for (const auto& pcb : wait_queue) {
-                    fork_waiting_pcbs.push_back(pcb);
-                }
-                
-                // Use helper function to append system status (child is running)
-                append_system_status(system_status, current_time, "FORK", duration_intr, 
-                                   child, fork_waiting_pcbs);
-                
-                ///////////////////////////////////////////////////////////////////////////////////////////
-            }           
-            ///////////////////////////////////////////////////////////////////////////////////////////
-
-            //The following loop helps you do 2 things:
-            // * Collect the trace of the child (and only the child, skip parent)
-            // * Get the index of where the parent is supposed to start executing from
-            std::vector<std::string> child_trace;
-            bool skip = true;
-            bool exec_flag = false;
-            int parent_index = 0;
-
-            for(size_t j = i; j < trace_file.size(); j++) {
-                auto [_activity, _duration, _pn] = parse_trace(trace_file[j]);
-                if(skip && _activity == "IF_CHILD") {
-                    skip = false;
-                    continue;
-                } else if(_activity == "IF_PARENT"){
-                    skip = true;
-                    parent_index = j;
-                    if(exec_flag) {
-                        break;
-                    }
-                } else if(skip && _activity == "ENDIF") {
-                    skip = false;
-                    continue;
-                } else if(!skip && _activity == "EXEC") {
-                    skip = true;
-                    child_trace.push_back(trace_file[j]);
-                    exec_flag = true;
-                }
-
-                if(!skip) {
-                    child_trace.push_back(trace_file[j]);
-                }
-            }
-            i = parent_index;
-
-            ///////////////////////////////////////////////////////////////////////////////////////////
-            //With the child's trace, run the child (HINT: think recursion)
-
-            if(child_partition != -1 && child_trace.size() > 0) {
-                // Create child_wait_queue with parent added
-                std::vector<PCB> child_wait_queue = wait_queue;
-                child_wait_queue.push_back(current);
-                
-                auto [child_execution, child_status, new_time] = simulate_trace(
-                    child_trace, current_time, vectors, delays, external_files, 
-                    child, child_wait_queue);
-                execution += child_execution;
-                system_status += child_status;
-                current_time = new_time;
-
-                memory[child_partition - 1].code = "empty";
-            }
-
-            ///////////////////////////////////////////////////////////////////////////////////////////
-
-        } else if(activity == "EXEC") {
-            std::cerr << "DEBUG: EXEC activity - program_name = '" << program_name << "'" << std::endl;
-
-            auto [intr, time] = intr_boilerplate(current_time, 3, 10, vectors);
-            current_time = time;
-            execution += intr;
+#include "simulator.hpp"
+#include "smp.hpp"
+#include "server.hpp"
+
+/*
+    Runs one job of a batch on a worker's simulator. The simulator's partition
+    table, sinks and buffers are its own; the configuration is shared read-only
+    between workers. Errors are reported in the result instead of ending the process.
+*/
+batch_result run_job(Simulator& simulator, const batch_job& job, const std::vector<unsigned int>& layout) {
+    batch_result result;
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        //The trace is opened before the outputs, so a missing trace leaves them alone
+        mapped_file trace(job.trace_path);
+        simulator.set_partition_layout(layout);
+        simulator.open_output(job.execution_path, job.status_path);
+        Simulator::run_result run = simulator.run(trace);
+        simulator.capture_output();
+
+        result.ok = true;
+        result.end_time = run.end_time;
+        result.events = run.events;
+        result.execution_bytes = run.execution_bytes;
+        result.status_bytes = run.status_bytes;
+    } catch(const simulator_error& error) {
+        result.error = error.what();
+    }
 
-            ///////////////////////////////////////////////////////////////////////////////////////////
-            //EXEC implementation
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
 
-            // Get program size inline
-            unsigned int exec_size = 0;
-            for(const auto& file : external_files) {
-                if(file.program_name == program_name) {
-                    exec_size = file.size;
-                    break;
-                }
-            }
+/*
+    Runs every job of a manifest on a pool of worker threads. Workers take the
+    next job index from a shared counter, so long traces do not hold up a whole
+    slice of the manifest. Partition layouts are read up front, once per file.
+    When stats (or analytics) is not null, every worker's stats (or analytics) are added to it.
+
+    returns the number of failed jobs
+*/
+int run_batch(std::shared_ptr<const simulation_context> context, const run_options& options, const std::string& manifest_path,
+              std::ostream& log, run_stats* stats, run_analytics* analytics, size_t& bytes_written) {
+    std::vector<batch_job> jobs = load_batch_manifest(manifest_path);
+
+    std::map<std::string, std::vector<unsigned int>> layouts;
+    layouts[""] = options.partitions_path.empty() ? std::vector<unsigned int>() : load_partition_layout(options.partitions_path);
+    for(const auto& job : jobs) {
+        if(!job.partitions_path.empty() && options.memory != memory_mode::FIXED) {
+            throw simulator_error(manifest_path + ": " + job.trace_path + " has a partition table, which only applies to --memory-mode fixed");
+        }
+        if(!job.partitions_path.empty() && layouts.count(job.partitions_path) == 0) {
+            layouts[job.partitions_path] = load_partition_layout(job.partitions_path);
+        }
+    }
 
-            // Find available partition using BEST FIT algorithm - DECLARE OUTSIDE IF BLOCK
-            int avail_exec_partition = -1;
-            int best_fit_size = 1000000;
-            for(int j = 0; j < 6; j++) {
-                if(memory[j].code == "empty" && memory[j].size >= exec_size) {
-                    int wasted_space = memory[j].size - exec_size;
-                    if(wasted_space < best_fit_size) {
-                        best_fit_size = wasted_space;
-                        avail_exec_partition = memory[j].partition_number;
-                    }
-                }
-            }
+    unsigned int thread_count = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::max(1u, std::min<unsigned int>(thread_count, jobs.size()));
+
+    std::vector<batch_result> results(jobs.size());
+    std::atomic<size_t> next_job{0};
+    std::mutex stats_lock;
+    auto worker = [&]() {
+        Simulator simulator(context);
+        simulator.collect_stats(stats != nullptr);
+        simulator.set_status_time(options.status_time);
+        simulator.memoize_exec(options.memo_exec);
+        simulator.collect_analytics(analytics != nullptr);
+        simulator.set_memory_mode(options.memory, options.memory_size);
+        simulator.set_placement(options.placement);
+        for(size_t k = next_job++; k < jobs.size(); k = next_job++) {
+            results[k] = run_job(simulator, jobs[k], layouts.at(jobs[k].partitions_path));
+        }
+        std::lock_guard<std::mutex> guard(stats_lock);
+        if(stats != nullptr) {
+            stats->merge(simulator.stats());
+        }
+        if(analytics != nullptr) {
+            analytics->merge(simulator.analytics());
+        }
+    };
 
-            if (exec_size == 0) {
-                execution += std::to_string(current_time) + ", EXEC ERROR: Program not found\n";
-            } else if (avail_exec_partition == -1) {
-                execution += std::to_string(current_time) + ", EXEC ERROR: No available partition\n";
-            } else {
-                execution += std::to_string(current_time) + ", " + std::to_string(duration_intr) + ", Program is " 
-                                                                + std::to_string(exec_size) + " Mb large\n";
-                current_time += duration_intr;
-
-                execution += std::to_string(current_time) + ", " + std::to_string(exec_size * 15) + ", loading program into memory\n";
-                current_time += (exec_size * 15);
-
-                execution += std::to_string(current_time) + ", 3, marking partition as occupied\n";
-                current_time += 3;
-
-                execution += std::to_string(current_time) + ", 6, updating PCB\n";
-                current_time += 6;
-
-                // Free old partition and mark new partition
-                memory[current.partition_number - 1].code = "empty";
-                memory[avail_exec_partition - 1].code = program_name;
-
-                execution += std::to_string(current_time) + ", 0, scheduler called\n";
-                execution += std::to_string(current_time) + ", 1, IRET\n";
-                current_time += 1;
-
-                ///////////////////////////////////////////////////////////////////////////////////////////
-                
-                
-                // Create exec'd PCB with new program name and size
-                PCB exec_running_pcb(current.PID, current.PPID, program_name, exec_size, avail_exec_partition);
-                
-                // Use helper function to append system status
-                append_system_status(system_status, current_time, "EXEC", duration_intr, 
-                                   exec_running_pcb, wait_queue);
-                
-                ///////////////////////////////////////////////////////////////////////////////////////////
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(unsigned int t = 1; t < thread_count; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : workers) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-            }
+    int failed = 0;
+    size_t total_events = 0;
+    std::unique_ptr<output_sink> summary = options.summary_path.empty() ? nullptr : open_sink(options.summary_path);
+    if(summary) {
+        write_text(*summary, "trace,status,end_time,events,execution_bytes,status_bytes,milliseconds,error\n");
+    }
+    for(size_t k = 0; k < jobs.size(); k++) {
+        const batch_result& result = results[k];
+        failed += !result.ok;
+        total_events += result.events;
+        bytes_written += result.execution_bytes + result.status_bytes;
+        if(!result.ok) {
+            std::cerr << "Error: " << jobs[k].trace_path << ": " << result.error << std::endl;
+        }
+        if(summary) {
+            std::ostringstream row;
+            row << jobs[k].trace_path << "," << (result.ok ? "ok" : "failed") << "," << result.end_time << ","
+                << result.events << "," << result.execution_bytes << "," << result.status_bytes << ","
+                << std::fixed << std::setprecision(3) << result.milliseconds << "," << result.error << "\n";
+            summary->write(row.str());
+        }
+    }
+    if(summary) {
+        summary->flush();
+    }
 
-            ///////////////////////////////////////////////////////////////////////////////////////////
+    log << "Ran " << jobs.size() << " job(s) on " << thread_count << " thread(s) in " << std::fixed << std::setprecision(3)
+        << seconds << " s: " << total_events << " events, " << failed << " failed" << std::endl;
+    return failed;
+}
 
-            std::ifstream exec_trace_file(program_name + ".txt");
+/*
+    Runs a trace in SMP mode (--cores, --async-io). Every core writes its own execution log
+    next to the execution path; the system status tables, which show every
+    core, go to the status path.
 
-            std::vector<std::string> exec_traces;
-            std::string exec_trace;
-            while(std::getline(exec_trace_file, exec_trace)) {
-                exec_traces.push_back(exec_trace);
-            }
+    returns the number of bytes written
+*/
+size_t run_smp(const simulation_context& context, const run_options& options, const mapped_file& input, std::ostream& log) {
+    compiled_trace trace = compile_trace(input.text(), context.external_files, context.tables(), input.path());
 
-            ///////////////////////////////////////////////////////////////////////////////////////////
-            //With the exec's trace (i.e. trace of external program), run the exec (HINT: think recursion)
-
-            if(exec_size != 0 && avail_exec_partition != -1) {
-                PCB exec_pcb(current.PID, current.PPID, program_name, exec_size, avail_exec_partition);
-                
-                // Create exec_wait_queue without current process
-                std::vector<PCB> exec_wait_queue;
-                for (const auto& pcb : wait_queue) {
-                    if (pcb.PID != current.PID) {
-                        exec_wait_queue.push_back(pcb);
-                    }
-                }
-                
-                auto [exec_execution, exec_status, exec_time] = simulate_trace(
-                    exec_traces, current_time, vectors, delays, external_files, 
-                    exec_pcb, exec_wait_queue);
-                execution += exec_execution;
-                system_status += exec_status;
-                current_time = exec_time;
-                
-                memory[avail_exec_partition - 1].code = "empty";
-            }
+    partition_manager memory(options.partitions_path.empty() ? partition_manager::default_layout()
+                                                             : load_partition_layout(options.partitions_path));
+    if(options.memory != memory_mode::FIXED) {
+        memory.configure(options.memory, options.memory_size);
+    }
+    memory.configure(options.placement);
+    event_formatter formatter(context.vectors);
+    status_history unused;  //core logs never take snapshots
+    std::vector<std::unique_ptr<output_sink>> sinks;
+    std::vector<std::unique_ptr<text_event_writer>> writers;
+    std::vector<std::unique_ptr<event_buffer>> buffers;
+    std::vector<event_buffer*> logs;
+    for(unsigned int k = 0; k < options.cores; k++) {
+        sinks.push_back(open_sink(smp_log_path(options.execution_path, k)));
+        writers.push_back(std::make_unique<text_event_writer>(formatter, *sinks.back(), unused));
+        buffers.push_back(std::make_unique<event_buffer>(*writers.back()));
+        logs.push_back(buffers.back().get());
+    }
+    std::unique_ptr<output_sink> status = open_sink(options.status_path);
 
-            ///////////////////////////////////////////////////////////////////////////////////////////
+    smp_result result = simulate_smp(context, trace, memory, logs, *status, options.async_io);
 
-            break; //Why is this important? (answer in report)
+    size_t bytes_written = status->bytes_written();
+    for(const auto& sink : sinks) {
+        bytes_written += sink->bytes_written();
+    }
+    log << "Execution written to " << smp_log_path(options.execution_path, 0) << " .. "
+        << smp_log_path(options.execution_path, options.cores - 1) << std::endl;
+    log << "System status written to " << options.status_path << " (" << status->bytes_written() << " bytes)" << std::endl;
+    print_smp_result(result, log);
+    return bytes_written;
+}
 
-        }
+//Prints the --stats report and writes its JSON copy if one was asked for
+void report_stats(const run_options& options, const run_stats& stats, size_t bytes_written, std::ostream& log) {
+    print_run_stats(stats, bytes_written, log);
+    if(options.stats_json_path.empty()) {
+        return;
     }
 
-    return {execution, system_status, current_time};
+    std::ostringstream json;
+    print_run_stats(stats, bytes_written, json, true);
+    std::unique_ptr<output_sink> sink = open_sink(options.stats_json_path);
+    sink->write(json.str());
+    sink->flush();
+}
+
+//Writes the --analytics summary
+void report_analytics(const run_options& options, const run_analytics& analytics) {
+    std::ostringstream summary;
+    print_run_analytics(analytics, summary);
+    std::unique_ptr<output_sink> sink = open_sink(options.analytics_path);
+    sink->write(summary.str());
+    sink->flush();
 }
 
 int main(int argc, char** argv) {
 
-    //vectors is a C++ std::vector of strings that contain the address of the ISR
-    //delays  is a C++ std::vector of ints that contain the delays of each device
+    //Stats (--stats) are collected from here on, argument parsing included
+    run_options options = parse_options(argc, argv);
+    run_stats stats;
+    stats_scope collect(options.stats ? &stats : nullptr);
+    size_t bytes_written = 0;
+
+    //context->vectors is a C++ std::vector of strings that contain the address of the ISR
+    //context->delays  is a C++ std::vector of ints that contain the delays of each device
     //the index of these elements is the device number, starting from 0
-    //external_files is a C++ std::vector of the struct 'external_file'. Check the struct in 
-    //interrupt.hpp to know more.
-    auto [vectors, delays, external_files] = parse_args(argc, argv);
-    std::ifstream input_file(argv[1]);
-
-    //Just a sanity check to know what files you have
-    print_external_files(external_files);
-
-    //Make initial PCB (notice how partition is not assigned yet)
-    PCB current(0, -1, "init", 1, -1);
-    //Update memory (partition is assigned here, you must implement this function)
-    if(!allocate_memory(&current)) {
-        std::cerr << "ERROR! Memory allocation failed!" << std::endl;
+    //context->external_files is the program registry: dense ids for the 'external_file' entries.
+    //Check the struct in interrupt.hpp to know more.
+    auto context = std::make_shared<simulation_context>();
+    {
+        STATS_TIMER(ARGUMENT_PARSING);
+        std::tie(context->vectors, context->delays, context->external_files) = parse_args(argc, argv);
+        context->timing = options.timing;
     }
 
-    std::vector<PCB> wait_queue;
+    try {
+        //Server mode: argv[1] is where traces come from; the tables and programs above are loaded once for all of them
+        if(options.serve) {
+            if(options.batch || options.cores != 0 || !options.binary_path.empty() || options.stats || !options.analytics_path.empty()) {
+                throw simulator_error("--serve replies with text output; it does not support --batch, --cores, --async-io, --binary, --stats or --analytics");
+            }
+            print_external_files(context->external_files.files(), std::cerr);
+            context->programs.load(context->external_files, context->tables());
+            context->programs.print_stats(context->external_files, std::cerr);
+            std::vector<unsigned int> layout = options.partitions_path.empty() ? std::vector<unsigned int>()
+                                                                               : load_partition_layout(options.partitions_path);
+            run_server(context, options, layout, argv[1], std::cerr);
+            return 0;
+        }
 
-    /******************ADD YOUR VARIABLES HERE*************************/
-    // All helper logic is now inlined in simulate_trace
+        //SMP mode: the trace runs on options.cores simulated CPUs
+        if(options.cores != 0) {
+            if(options.batch || !options.binary_path.empty() || options.status_time >= 0 || options.execution_path == "-" || options.memo_exec
+               || !options.analytics_path.empty()) {
+                throw simulator_error("--cores and --async-io write one text log per core; they do not support --batch, --binary, --status-at, --memo-exec, --analytics or --execution -");
+            }
+            std::ostream& log = options.status_path == "-" ? std::cerr : std::cout;
+            print_external_files(context->external_files.files(), log);
+            context->programs.load(context->external_files, context->tables());
+            context->programs.print_stats(context->external_files, log);
+            bytes_written = run_smp(*context, options, mapped_file(argv[1]), log);
+            if(options.stats) {
+                report_stats(options, stats, bytes_written, log);
+            }
+            return 0;
+        }
 
-    /******************************************************************/
+        //Batch mode: argv[1] is a manifest and every job writes its own files
+        if(options.batch) {
+            if(!options.binary_path.empty()) {
+                throw simulator_error("--binary is not supported with --batch");
+            }
+            print_external_files(context->external_files.files());
+            context->programs.load(context->external_files, context->tables());
+            context->programs.print_stats(context->external_files);
+            run_analytics analytics;
+            bool analysing = !options.analytics_path.empty();
+            int failed = run_batch(context, options, argv[1], std::cout, options.stats ? &stats : nullptr,
+                                   analysing ? &analytics : nullptr, bytes_written);
+            if(analysing) {
+                report_analytics(options, analytics);
+            }
+            if(options.stats) {
+                report_stats(options, stats, bytes_written, std::cout);
+            }
+            return failed == 0 ? 0 : 1;
+        }
 
-    //Converting the trace file into a vector of strings.
-    std::vector<std::string> trace_file;
-    std::string trace;
-    while(std::getline(input_file, trace)) {
-        trace_file.push_back(trace);
-    }
+        //The trace is opened before the outputs, so a missing trace leaves them alone
+        mapped_file trace(argv[1]);
+
+        //Output is streamed while simulating, either as text or as one binary log
+        bool binary_output = !options.binary_path.empty();
+        Simulator simulator(context);
+        simulator.set_status_time(options.status_time);
+        simulator.memoize_exec(options.memo_exec);
+        simulator.collect_analytics(!options.analytics_path.empty());
+        simulator.set_memory_mode(options.memory, options.memory_size);
+        simulator.set_placement(options.placement);
+        if(binary_output) {
+            simulator.open_binary_output(options.binary_path);
+        } else {
+            simulator.open_output(options.execution_path, options.status_path);
+        }
+
+        //Keep stdout clean if it is one of the sinks
+        bool stdout_output = !binary_output && (options.execution_path == "-" || options.status_path == "-");
+        std::ostream& log = stdout_output ? std::cerr : std::cout;
+
+        //Just a sanity check to know what files you have
+        print_external_files(context->external_files.files(), log);
+
+        //Every program that can be EXEC'd is read and compiled once here
+        context->programs.load(context->external_files, context->tables());
+        context->programs.print_stats(context->external_files, log);
+
+        if(!options.partitions_path.empty()) {
+            simulator.load_partitions(options.partitions_path);
+        }
 
-    auto [execution, system_status, _] = simulate_trace(trace_file, 
-                                            0, 
-                                            vectors, 
-                                            delays,
-                                            external_files, 
-                                            current, 
-                                            wait_queue);
+        //The trace is compiled once and run from time 0 with init in the smallest partition that fits
+        Simulator::run_result result = simulator.run(trace);
 
-    input_file.close();
+        if(binary_output) {
+            log << "Event log written to " << options.binary_path << " (" << result.execution_bytes << " bytes)" << std::endl;
+        } else {
+            log << "Execution written to " << options.execution_path << " (" << result.execution_bytes << " bytes)" << std::endl;
+            log << "System status written to " << options.status_path << " (" << result.status_bytes << " bytes)" << std::endl;
+        }
 
-    write_output(execution, "output_files/execution_5.txt");
-    write_output(system_status, "output_files/system_status_5.txt");
+        if(!options.analytics_path.empty()) {
+            report_analytics(options, simulator.analytics());
+        }
+
+        if(options.stats) {
+            report_stats(options, stats, result.execution_bytes + result.status_bytes, log);
+        }
+    } catch(const simulator_error& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
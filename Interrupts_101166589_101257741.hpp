@@ -10,247 +10,2866 @@
 #include<sstream>
 #include<iomanip>
 #include <algorithm>
+#include<tuple>
+#include<charconv>
+#include<cctype>
+#include<cstdint>
+#include<memory>
+#include<unordered_map>
+#include<set>
+#include<thread>
+#include<atomic>
+#include<chrono>
+#include<map>
+#include<mutex>
+#include<stdexcept>
+#include<string_view>
+#include<optional>
+#include<variant>
+#include<cstring>
 #include<stdio.h>
 
+#ifndef _WIN32
+#include<sys/resource.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
+
 #define ADDR_BASE   0
 #define VECTOR_SIZE 2
 
-struct memory_partition_t {
-    const unsigned int partition_number;
-    const unsigned int size;
-    std::string code;
+#define NO_OWNER    -1
+
+//Raised for unreadable or malformed input; the command line tools print it and exit
+class simulator_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/*
+    Run statistics (--stats). Hooks count events and time the main phases into
+    the run_stats of the current thread, if one is active. Building with
+    -DSIM_STATS=0 turns every hook into nothing.
+*/
+#ifndef SIM_STATS
+#define SIM_STATS   1
+#endif
+
+enum class stat_counter : uint8_t {
+    CPU,
+    SYSCALL,
+    END_IO,
+    FORK,
+    FORK_ERROR,
+    EXEC,
+    EXEC_ERROR,
+    PROGRAM_LOAD,
+    SNAPSHOT,
+    EVENT,
+    EXEC_REPLAY,    //EXECs replayed from the memo (--memo-exec) instead of simulated
+    COUNT
+};
+
+enum class stat_timer : uint8_t {
+    ARGUMENT_PARSING,
+    TRACE_PARSING,
+    FORK_EXTRACTION,
+    ALLOCATION,
+    SIMULATION,
+    OUTPUT,
+    COUNT
+};
+
+struct run_stats {
+    uint64_t counters[static_cast<size_t>(stat_counter::COUNT)] = {};
+    uint64_t calls[static_cast<size_t>(stat_timer::COUNT)] = {};
+    uint64_t nanoseconds[static_cast<size_t>(stat_timer::COUNT)] = {};
+
+    void merge(const run_stats& other) {
+        for(size_t k = 0; k < static_cast<size_t>(stat_counter::COUNT); k++) {
+            counters[k] += other.counters[k];
+        }
+        for(size_t k = 0; k < static_cast<size_t>(stat_timer::COUNT); k++) {
+            calls[k] += other.calls[k];
+            nanoseconds[k] += other.nanoseconds[k];
+        }
+    }
+};
+
+//Where the hooks of this thread record, nullptr when nobody asked for stats
+thread_local run_stats* active_stats = nullptr;
+
+//Adds the time until it goes out of scope to a timer of the active stats
+class scoped_timer {
+public:
+    explicit scoped_timer(stat_timer _timer) : stats(active_stats), timer(static_cast<size_t>(_timer)) {
+        if(stats != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~scoped_timer() {
+        if(stats != nullptr) {
+            stats->calls[timer]++;
+            stats->nanoseconds[timer] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+private:
+    run_stats* stats;
+    size_t timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+//Makes stats the active stats of this thread until the end of the scope
+class stats_scope {
+public:
+    explicit stats_scope(run_stats* stats) : previous(active_stats) {
+        active_stats = stats;
+    }
+
+    ~stats_scope() {
+        active_stats = previous;
+    }
+
+private:
+    run_stats* previous;
+};
+
+#define STATS_CONCAT_(a, b)     a##b
+#define STATS_CONCAT(a, b)      STATS_CONCAT_(a, b)
+
+#if SIM_STATS
+#define STATS_ADD(counter, n)   do { if(active_stats != nullptr) active_stats->counters[static_cast<size_t>(stat_counter::counter)] += (n); } while(0)
+#define STATS_TIMER(timer)      scoped_timer STATS_CONCAT(stats_timer_, __LINE__)(stat_timer::timer)
+#else
+#define STATS_ADD(counter, n)   do {} while(0)
+#define STATS_TIMER(timer)      do {} while(0)
+#endif
+
+#define STATS_COUNT(counter)    STATS_ADD(counter, 1)
+
+//Peak resident set size of the process so far, in KiB (0 where it is not available)
+long peak_rss_kb() {
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+//Prints the stats as a table, or as one JSON object
+void print_run_stats(const run_stats& stats, size_t bytes_written, std::ostream& out, bool json = false) {
+    static const char* counter_names[] = {"cpu", "syscall", "end_io", "fork", "fork_error", "exec", "exec_error",
+                                          "program_load", "snapshot", "event", "exec_replay"};
+    static const char* timer_names[] = {"argument_parsing", "trace_parsing", "fork_extraction", "allocation",
+                                        "simulation", "output"};
+    static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == static_cast<size_t>(stat_counter::COUNT),
+                  "every counter needs a name");
+    static_assert(sizeof(timer_names) / sizeof(timer_names[0]) == static_cast<size_t>(stat_timer::COUNT),
+                  "every timer needs a name");
+
+    std::ios::fmtflags flags = out.flags();
+    char fill = out.fill(' ');
+    if(json) {
+        out << "{\"counters\": {";
+        for(size_t k = 0; k < static_cast<size_t>(stat_counter::COUNT); k++) {
+            out << (k ? ", " : "") << "\"" << counter_names[k] << "\": " << stats.counters[k];
+        }
+        out << "}, \"timers\": {";
+        for(size_t k = 0; k < static_cast<size_t>(stat_timer::COUNT); k++) {
+            out << (k ? ", " : "") << "\"" << timer_names[k] << "\": {\"calls\": " << stats.calls[k]
+                << ", \"ms\": " << std::fixed << std::setprecision(3) << stats.nanoseconds[k] / 1e6 << "}";
+        }
+        out << "}, \"bytes_written\": " << bytes_written << ", \"peak_rss_kb\": " << peak_rss_kb() << "}" << std::endl;
+    } else {
+        out << "Run statistics" << (SIM_STATS ? "" : " (not compiled in, build with -DSIM_STATS=1)") << std::endl;
+        for(size_t k = 0; k < static_cast<size_t>(stat_counter::COUNT); k++) {
+            out << "  " << std::left << std::setw(20) << counter_names[k] << std::right << std::setw(12) << stats.counters[k] << std::endl;
+        }
+        out << "  " << std::left << std::setw(20) << "phase (inclusive)" << std::right << std::setw(12) << "calls"
+            << std::setw(12) << "ms" << std::endl;
+        for(size_t k = 0; k < static_cast<size_t>(stat_timer::COUNT); k++) {
+            out << "  " << std::left << std::setw(20) << timer_names[k] << std::right << std::setw(12) << stats.calls[k]
+                << std::setw(12) << std::fixed << std::setprecision(3) << stats.nanoseconds[k] / 1e6 << std::endl;
+        }
+        out << "  " << std::left << std::setw(20) << "bytes written" << std::right << std::setw(12) << bytes_written << std::endl;
+        out << "  " << std::left << std::setw(20) << "peak memory (KiB)" << std::right << std::setw(12) << peak_rss_kb() << std::endl;
+    }
+    out.flags(flags);
+    out.fill(fill);
+}
+
+//Online analytics (--analytics, see run_analytics): the partition table reports every change through these hooks
+struct run_analytics;
+thread_local run_analytics* active_analytics = nullptr;
+void analytics_occupy(unsigned int partition_number, unsigned int size, unsigned int used);
+void analytics_release(unsigned int partition_number);
+
+struct memory_partition_t {
+    const unsigned int partition_number;
+    const unsigned int size;
+    int owner;  //PID of the process using the partition, NO_OWNER when it is empty
+
+    memory_partition_t(unsigned int _pn, unsigned int _s, int _o = NO_OWNER):
+        partition_number(_pn), size(_s), owner(_o) {}
+};
+
+/*
+    Fixed partition table. Free partitions are indexed two ways so every placement
+    policy runs in O(log n):
+      * by (size, index) in an ordered set, for best fit and worst fit
+      * by index in a max segment tree of free sizes, for first fit from either end
+        and for next fit, which starts after the partition occupied last
+    Partition numbers are 1-based, in the order the partitions were configured.
+*/
+class fixed_partitions {
+public:
+    explicit fixed_partitions(const std::vector<unsigned int>& sizes) {
+        configure(sizes);
+    }
+
+    //Replaces the table with empty partitions of the given sizes
+    void configure(const std::vector<unsigned int>& sizes) {
+        partitions.clear();
+        free_by_size.clear();
+        cursor = 0;
+        leaves = 1;
+        while(leaves < sizes.size()) {
+            leaves *= 2;
+        }
+        tree.assign(2 * leaves, 0);
+
+        for(size_t k = 0; k < sizes.size(); k++) {
+            partitions.emplace_back(k + 1, sizes[k]);
+            free_by_size.emplace(sizes[k], k);
+            tree[leaves + k] = sizes[k] + 1ULL;
+        }
+        for(size_t node = leaves - 1; node > 0; node--) {
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    size_t count() const {
+        return partitions.size();
+    }
+
+    const memory_partition_t& operator[](size_t index) const {
+        return partitions[index];
+    }
+
+    //Smallest free partition that fits (lowest number on ties), -1 if none
+    int best_fit(unsigned int size) const {
+        auto it = free_by_size.lower_bound({size, 0});
+        return it == free_by_size.end() ? -1 : partitions[it->second].partition_number;
+    }
+
+    //Largest free partition (lowest number on ties), -1 if it is too small
+    int worst_fit(unsigned int size) const {
+        if(free_by_size.empty()) {
+            return -1;
+        }
+        unsigned int largest = free_by_size.rbegin()->first;
+        if(largest < size) {
+            return -1;
+        }
+        return partitions[free_by_size.lower_bound({largest, 0})->second].partition_number;
+    }
+
+    //Lowest-numbered free partition that fits, -1 if none
+    int first_fit(unsigned int size) const {
+        return find(size, false);
+    }
+
+    //Highest-numbered free partition that fits, -1 if none
+    int last_fit(unsigned int size) const {
+        return find(size, true);
+    }
+
+    //First free partition that fits after the one occupied last, wrapping around; -1 if none
+    int next_fit(unsigned int size) const {
+        long index = find_from(1, 0, leaves, cursor, size + 1ULL);
+        if(index < 0) {
+            index = find_from(1, 0, leaves, 0, size + 1ULL);
+        }
+        return index < 0 ? -1 : partitions[index].partition_number;
+    }
+
+    //Next fit starts from the first partition again
+    void rewind() {
+        cursor = 0;
+    }
+
+    bool is_free(int partition_number) const {
+        return valid(partition_number) && partitions[partition_number - 1].owner == NO_OWNER;
+    }
+
+    //Marks a free partition as used by pid; returns its size, 0 if it was not free
+    unsigned int occupy(int partition_number, unsigned int pid, unsigned int) {
+        if(!is_free(partition_number)) {
+            return 0;
+        }
+        size_t index = partition_number - 1;
+        partitions[index].owner = pid;
+        free_by_size.erase({partitions[index].size, index});
+        update(index, 0);
+        cursor = index + 1;
+        return partitions[index].size;
+    }
+
+    //Marks a partition as empty; releasing an empty (or invalid) partition does nothing and returns false
+    bool release(int partition_number) {
+        if(!valid(partition_number) || is_free(partition_number)) {
+            return false;
+        }
+        size_t index = partition_number - 1;
+        partitions[index].owner = NO_OWNER;
+        free_by_size.emplace(partitions[index].size, index);
+        update(index, partitions[index].size + 1ULL);
+        return true;
+    }
+
+    unsigned int capacity() const {
+        unsigned int total = 0;
+        for(const auto& partition : partitions) {
+            total += partition.size;
+        }
+        return total;
+    }
+
+private:
+    std::vector<memory_partition_t> partitions;
+    std::set<std::pair<unsigned int, size_t>> free_by_size;
+    std::vector<unsigned long long> tree;   //tree[leaves + k] is 1 + free size of partition k, 0 when used
+    size_t leaves = 1;
+    size_t cursor = 0;                      //index after the partition occupied last
+
+    bool valid(int partition_number) const {
+        return partition_number >= 1 && static_cast<size_t>(partition_number) <= partitions.size();
+    }
+
+    void update(size_t index, unsigned long long value) {
+        size_t node = leaves + index;
+        tree[node] = value;
+        for(node /= 2; node > 0; node /= 2) {
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    //Walks down the segment tree towards the leftmost (or rightmost) leaf that fits
+    int find(unsigned int size, bool from_end) const {
+        unsigned long long needed = size + 1ULL;
+        if(partitions.empty() || tree[1] < needed) {
+            return -1;
+        }
+        size_t node = 1;
+        while(node < leaves) {
+            size_t first = from_end ? 2 * node + 1 : 2 * node;
+            size_t second = from_end ? 2 * node : 2 * node + 1;
+            node = tree[first] >= needed ? first : second;
+        }
+        return partitions[node - leaves].partition_number;
+    }
+
+    //Leftmost index >= from under node (which covers [low, high)) whose leaf holds needed, -1 if none
+    long find_from(size_t node, size_t low, size_t high, size_t from, unsigned long long needed) const {
+        if(high <= from || tree[node] < needed) {
+            return -1;
+        }
+        if(node >= leaves) {
+            return node - leaves;
+        }
+        size_t middle = (low + high) / 2;
+        long index = find_from(2 * node, low, middle, from, needed);
+        return index >= 0 ? index : find_from(2 * node + 1, middle, high, from, needed);
+    }
+};
+
+/*
+    Placement policies for the fixed table: where a program of size Mb goes,
+    -1 if no free partition fits. A policy is a type, not an object, so
+    placed_partitions<Policy>::place() inlines the search it picks.
+*/
+struct best_fit_policy {
+    static int place(const fixed_partitions& table, unsigned int size) {
+        return table.best_fit(size);
+    }
+};
+
+struct first_fit_policy {
+    static int place(const fixed_partitions& table, unsigned int size) {
+        return table.first_fit(size);
+    }
+};
+
+struct worst_fit_policy {
+    static int place(const fixed_partitions& table, unsigned int size) {
+        return table.worst_fit(size);
+    }
+};
+
+struct next_fit_policy {
+    static int place(const fixed_partitions& table, unsigned int size) {
+        return table.next_fit(size);
+    }
+};
+
+//A fixed partition table that places programs with Policy
+template<typename Policy>
+class placed_partitions : public fixed_partitions {
+public:
+    using fixed_partitions::fixed_partitions;
+
+    int place(unsigned int size) const {
+        return Policy::place(*this, size);
+    }
+};
+
+/*
+    Binary buddy allocator over total Mb. A total that is not a power of two is
+    covered by the largest aligned power-of-two blocks that fit. A request gets
+    the smallest free block of 2^k Mb that holds it (lowest address on ties),
+    split in halves as far as it goes; a freed block merges with its buddy for
+    as long as the buddy is free too. Blocks are named by their start address:
+    partition number = address + 1.
+*/
+class buddy_allocator {
+public:
+    explicit buddy_allocator(unsigned int _total) {
+        configure(_total);
+    }
+
+    void configure(unsigned int _total) {
+        total = _total;
+        free_blocks.assign(ORDERS, {});
+        used.clear();
+        for(unsigned int address = 0; address < total;) {
+            unsigned int order = ORDERS - 1;
+            while(order > 0 && (address % (1u << order) != 0 || total - address < (1u << order))) {
+                order--;
+            }
+            free_blocks[order].insert(address);
+            address += 1u << order;
+        }
+    }
+
+    //Smallest free block that holds size Mb, lowest address on ties
+    int place(unsigned int size) const {
+        for(unsigned int order = order_of(size); order < ORDERS; order++) {
+            if(!free_blocks[order].empty()) {
+                return *free_blocks[order].begin() + 1;
+            }
+        }
+        return -1;
+    }
+
+    //Takes a block of 2^k >= size Mb at the block's address, splitting the free block around it; returns its size
+    unsigned int occupy(int partition_number, unsigned int pid, unsigned int size) {
+        unsigned int address = partition_number - 1;
+        unsigned int need = order_of(size);
+        if(partition_number < 1 || address % (1u << need) != 0 || used.count(address) != 0) {
+            return 0;
+        }
+
+        for(unsigned int order = need; order < ORDERS; order++) {
+            unsigned int base = address & ~((1u << order) - 1);
+            if(free_blocks[order].erase(base) == 0) {
+                continue;
+            }
+            //Keep the half holding address, free the other one
+            while(order > need) {
+                order--;
+                unsigned int half = 1u << order;
+                free_blocks[order].insert(address & half ? base : base + half);
+                base = address & half ? base + half : base;
+            }
+            used.emplace(address, std::make_pair(need, pid));
+            return 1u << need;
+        }
+        return 0;
+    }
+
+    bool release(int partition_number) {
+        auto it = used.find(partition_number - 1);
+        if(partition_number < 1 || it == used.end()) {
+            return false;
+        }
+        unsigned int address = it->first;
+        unsigned int order = it->second.first;
+        used.erase(it);
+
+        for(; order + 1 < ORDERS; order++) {
+            unsigned int buddy = address ^ (1u << order);
+            if(buddy > total || total - buddy < (1u << order) || free_blocks[order].erase(buddy) == 0) {
+                break;
+            }
+            address = std::min(address, buddy);
+        }
+        free_blocks[order].insert(address);
+        return true;
+    }
+
+    unsigned int capacity() const {
+        return total;
+    }
+
+private:
+    static const unsigned int ORDERS = 32;
+
+    unsigned int total = 0;
+    std::vector<std::set<unsigned int>> free_blocks;                        //start addresses by order
+    std::unordered_map<unsigned int, std::pair<unsigned int, unsigned int>> used;  //address -> (order, pid)
+
+    static unsigned int order_of(unsigned int size) {
+        unsigned int order = 0;
+        while(order + 1 < ORDERS && (1u << order) < size) {
+            order++;
+        }
+        return order;
+    }
+};
+
+/*
+    Segregated free-list allocator over total Mb. Free extents are kept by
+    address, so a freed extent merges with free neighbours on both sides, and
+    by size class c = [2^c, 2^(c+1)) Mb. A request looks through its own class
+    for the lowest-addressed extent that holds it, then takes the first extent
+    of the next class that has one. It is cut from the front of the extent, so
+    nothing is lost to rounding. Partition number = address + 1.
+*/
+class free_list_allocator {
+public:
+    explicit free_list_allocator(unsigned int _total) {
+        configure(_total);
+    }
+
+    void configure(unsigned int _total) {
+        total = _total;
+        extents.clear();
+        classes.assign(CLASSES, {});
+        used.clear();
+        if(total > 0) {
+            add_extent(0, total);
+        }
+    }
+
+    //First free extent of size Mb's class that holds it, else the lowest extent of a larger class
+    int place(unsigned int size) const {
+        size = std::max(size, 1u);
+        unsigned int first = class_of(size);
+        for(unsigned int address : classes[first]) {
+            if(extents.at(address) >= size) {
+                return address + 1;
+            }
+        }
+        for(unsigned int c = first + 1; c < CLASSES; c++) {
+            if(!classes[c].empty()) {
+                return *classes[c].begin() + 1;
+            }
+        }
+        return -1;
+    }
+
+    //Cuts size Mb at the block's address out of the free extent holding it; returns size, 0 if it does not fit
+    unsigned int occupy(int partition_number, unsigned int pid, unsigned int size) {
+        size = std::max(size, 1u);
+        unsigned int address = partition_number - 1;
+        auto it = extents.upper_bound(address);
+        if(partition_number < 1 || it == extents.begin()) {
+            return 0;
+        }
+        --it;
+        unsigned int start = it->first;
+        unsigned int end = start + it->second;
+        if(address >= end || end - address < size) {
+            return 0;
+        }
+
+        remove_extent(it);
+        if(start < address) {
+            add_extent(start, address - start);
+        }
+        if(address + size < end) {
+            add_extent(address + size, end - address - size);
+        }
+        used.emplace(address, std::make_pair(size, pid));
+        return size;
+    }
+
+    bool release(int partition_number) {
+        auto it = used.find(partition_number - 1);
+        if(partition_number < 1 || it == used.end()) {
+            return false;
+        }
+        unsigned int start = it->first;
+        unsigned int end = start + it->second.first;
+        used.erase(it);
+
+        auto next = extents.lower_bound(start);
+        if(next != extents.end() && next->first == end) {
+            end += next->second;
+            next = remove_extent(next);
+        }
+        if(next != extents.begin()) {
+            auto previous = std::prev(next);
+            if(previous->first + previous->second == start) {
+                start = previous->first;
+                remove_extent(previous);
+            }
+        }
+        add_extent(start, end - start);
+        return true;
+    }
+
+    unsigned int capacity() const {
+        return total;
+    }
+
+private:
+    static const unsigned int CLASSES = 32;
+
+    unsigned int total = 0;
+    std::map<unsigned int, unsigned int> extents;       //free extents: address -> length
+    std::vector<std::set<unsigned int>> classes;        //free extent addresses by size class
+    std::unordered_map<unsigned int, std::pair<unsigned int, unsigned int>> used;  //address -> (length, pid)
+
+    static unsigned int class_of(unsigned int length) {
+        unsigned int c = 0;
+        while(c + 1 < CLASSES && (2u << c) <= length) {
+            c++;
+        }
+        return c;
+    }
+
+    void add_extent(unsigned int address, unsigned int length) {
+        extents.emplace(address, length);
+        classes[class_of(length)].insert(address);
+    }
+
+    std::map<unsigned int, unsigned int>::iterator remove_extent(std::map<unsigned int, unsigned int>::iterator it) {
+        classes[class_of(it->second)].erase(it->first);
+        return extents.erase(it);
+    }
+};
+
+//How memory is handed out: the fixed partition table, or one of the dynamic allocators over --memory-size Mb
+enum class memory_mode : uint8_t {
+    FIXED,
+    BUDDY,
+    FREE_LIST
+};
+
+//Which free partition of the fixed table a program goes to (--placement)
+enum class placement_policy : uint8_t {
+    BEST_FIT,
+    FIRST_FIT,
+    WORST_FIT,
+    NEXT_FIT
+};
+
+//The --placement name of a policy
+const char* placement_name(placement_policy policy) {
+    switch(policy) {
+        case placement_policy::BEST_FIT:  return "best";
+        case placement_policy::FIRST_FIT: return "first";
+        case placement_policy::WORST_FIT: return "worst";
+        case placement_policy::NEXT_FIT:  return "next";
+        default:                          return "unknown";
+    }
+}
+
+class partition_manager;
+
+/*
+    A partition_manager whose allocator has been resolved to Table. The engines
+    run their loops on one of these (see partition_manager::with_table), so
+    place, occupy and release call the allocator directly, with the placement
+    policy inlined, instead of going through the variant on every call.
+*/
+template<typename Table>
+class resolved_partitions {
+public:
+    resolved_partitions(partition_manager& _manager, Table& _table) : owner(&_manager), table(&_table) {}
+
+    //The manager this view belongs to, for code that works on any allocator (the memo, init's allocation)
+    partition_manager& manager() const {
+        return *owner;
+    }
+
+    int place(unsigned int size) const {
+        return table->place(size);
+    }
+
+    void occupy(int partition_number, unsigned int pid, unsigned int used) {
+        unsigned int size = table->occupy(partition_number, pid, used);
+        if(size != 0 && active_analytics != nullptr) {
+            analytics_occupy(partition_number, size, used);
+        }
+    }
+
+    void release(int partition_number) {
+        if(table->release(partition_number) && active_analytics != nullptr) {
+            analytics_release(partition_number);
+        }
+    }
+
+private:
+    partition_manager* owner;
+    Table* table;
+};
+
+/*
+    The machine's memory as the engines see it. It holds one of the allocators
+    above and forwards to it without virtual calls. The engines ask for a
+    partition number (place, or last_fit for init), then occupy and release
+    it; in the dynamic modes the number names a block that occupy() carves out
+    and release() coalesces again. Analytics (see run_analytics) hear about every
+    change from here.
+*/
+class partition_manager {
+public:
+    explicit partition_manager(const std::vector<unsigned int>& sizes = default_layout())
+        : table(placed_partitions<best_fit_policy>(sizes)) {}
+
+    //The six partitions of the assignment: 40, 25, 15, 10, 8 and 2 Mb
+    static std::vector<unsigned int> default_layout() {
+        return {40, 25, 15, 10, 8, 2};
+    }
+
+    //Replaces the memory with a fixed table of empty partitions of the given sizes; a fixed table keeps its policy
+    void configure(const std::vector<unsigned int>& sizes) {
+        if(fixed_partitions* current = fixed()) {
+            current->configure(sizes);
+        } else {
+            table = placed_partitions<best_fit_policy>(sizes);
+        }
+    }
+
+    //Replaces the memory with total Mb handed out by a dynamic allocator
+    void configure(memory_mode mode, unsigned int total) {
+        if(mode == memory_mode::BUDDY) {
+            table = buddy_allocator(total);
+        } else if(mode == memory_mode::FREE_LIST) {
+            table = free_list_allocator(total);
+        }
+    }
+
+    //Rebuilds the fixed table, empty, with another placement policy; the dynamic modes place blocks their own way
+    void configure(placement_policy policy) {
+        const fixed_partitions* current = fixed();
+        if(current == nullptr || policy == placement()) {
+            return;
+        }
+        std::vector<unsigned int> sizes;
+        for(size_t k = 0; k < current->count(); k++) {
+            sizes.push_back((*current)[k].size);
+        }
+        switch(policy) {
+            case placement_policy::BEST_FIT:  table = placed_partitions<best_fit_policy>(sizes); break;
+            case placement_policy::FIRST_FIT: table = placed_partitions<first_fit_policy>(sizes); break;
+            case placement_policy::WORST_FIT: table = placed_partitions<worst_fit_policy>(sizes); break;
+            case placement_policy::NEXT_FIT:  table = placed_partitions<next_fit_policy>(sizes); break;
+        }
+    }
+
+    memory_mode mode() const {
+        if(fixed() != nullptr) {
+            return memory_mode::FIXED;
+        }
+        return std::holds_alternative<buddy_allocator>(table) ? memory_mode::BUDDY : memory_mode::FREE_LIST;
+    }
+
+    //Policy of the fixed table; best fit in the dynamic modes, which is what both allocators approximate
+    placement_policy placement() const {
+        return fixed() != nullptr ? static_cast<placement_policy>(table.index()) : placement_policy::BEST_FIT;
+    }
+
+    //Partitions of the fixed table; the dynamic modes have none to list
+    size_t count() const {
+        const fixed_partitions* current = fixed();
+        return current ? current->count() : 0;
+    }
+
+    const memory_partition_t& operator[](size_t index) const {
+        return (*fixed())[index];
+    }
+
+    //Largest partition number that can be handed out
+    size_t slots() const {
+        return mode() == memory_mode::FIXED ? count() : capacity();
+    }
+
+    //Mb of memory in all
+    unsigned int capacity() const {
+        return std::visit([](const auto& memory) { return memory.capacity(); }, table);
+    }
+
+    //Where a program of size Mb goes, as the fixed table's policy or the allocator decides; -1 if none
+    int place(unsigned int size) const {
+        return std::visit([size](const auto& memory) { return memory.place(size); }, table);
+    }
+
+    //Where init goes: the highest-numbered free partition that fits, or the allocator's choice; -1 if none
+    int last_fit(unsigned int size) const {
+        if(const fixed_partitions* current = fixed()) {
+            return current->last_fit(size);
+        }
+        return place(size);
+    }
+
+    //Gives partition_number to pid, whose program takes used Mb of it
+    void occupy(int partition_number, unsigned int pid, unsigned int used) {
+        unsigned int size = std::visit([&](auto& memory) { return memory.occupy(partition_number, pid, used); }, table);
+        if(size != 0 && active_analytics != nullptr) {
+            analytics_occupy(partition_number, size, used);
+        }
+    }
+
+    //Frees a partition; releasing an empty (or invalid) one does nothing
+    void release(int partition_number) {
+        bool released = std::visit([partition_number](auto& memory) { return memory.release(partition_number); }, table);
+        if(released && active_analytics != nullptr) {
+            analytics_release(partition_number);
+        }
+    }
+
+    //Calls body with a resolved_partitions for the current allocator, resolving it once for the whole call.
+    //body must not reconfigure the memory.
+    template<typename Body>
+    decltype(auto) with_table(Body&& body) {
+        return std::visit([&](auto& memory) {
+            resolved_partitions<std::decay_t<decltype(memory)>> resolved(*this, memory);
+            return body(resolved);
+        }, table);
+    }
+
+    //Empties every partition; next fit starts from the first one again
+    void release_all() {
+        if(fixed_partitions* current = fixed()) {
+            for(size_t k = 0; k < current->count(); k++) {
+                release((*current)[k].partition_number);
+            }
+            current->rewind();
+        } else {
+            configure(mode(), capacity());
+        }
+    }
+
+private:
+    //The fixed tables come first, in placement_policy order
+    std::variant<placed_partitions<best_fit_policy>, placed_partitions<first_fit_policy>,
+                 placed_partitions<worst_fit_policy>, placed_partitions<next_fit_policy>,
+                 buddy_allocator, free_list_allocator> table;
+
+    const fixed_partitions* fixed() const {
+        return const_cast<partition_manager*>(this)->fixed();
+    }
+
+    //The fixed table whatever its policy, nullptr in the dynamic modes
+    fixed_partitions* fixed() {
+        return std::visit([](auto& memory) -> fixed_partitions* {
+            if constexpr(std::is_base_of<fixed_partitions, std::decay_t<decltype(memory)>>::value) {
+                return &memory;
+            } else {
+                return nullptr;
+            }
+        }, table);
+    }
+};
+
+//Interned program name, see symbol_table
+typedef uint32_t symbol;
+
+/*
+    Process-wide intern table for program names. Each name is stored once and
+    gets a small integer symbol; PCBs and the program registry carry symbols and
+    names are only looked up when output is written. Names live in fixed chunks
+    that never move, so name() needs no lock and can run alongside intern() on
+    other threads (batch workers). Symbol 0 is reserved for "empty".
+*/
+class symbol_table {
+public:
+    static const symbol EMPTY = 0;
+
+    symbol_table() {
+        intern("empty");
+    }
+
+    //Symbol of a name, adding it the first time it is seen
+    symbol intern(std::string_view name) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(name);
+        if(it != ids.end()) {
+            return it->second;
+        }
+
+        size_t id = count.load(std::memory_order_relaxed);
+        if(id >= CHUNK_SIZE * MAX_CHUNKS) {
+            throw simulator_error("too many program names");
+        }
+        std::unique_ptr<std::string[]>& chunk = chunks[id / CHUNK_SIZE];
+        if(!chunk) {
+            chunk = std::make_unique<std::string[]>(CHUNK_SIZE);
+        }
+        std::string& stored = chunk[id % CHUNK_SIZE];
+        stored.assign(name.data(), name.size());
+        ids.emplace(std::string_view(stored), static_cast<symbol>(id));
+        count.store(id + 1, std::memory_order_release);
+        return static_cast<symbol>(id);
+    }
+
+    const std::string& name(symbol id) const {
+        static const std::string unknown = "unknown";
+        return id < count.load(std::memory_order_acquire) ? chunks[id / CHUNK_SIZE][id % CHUNK_SIZE] : unknown;
+    }
+
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 1024;
+    static const size_t MAX_CHUNKS = 4096;
+
+    std::mutex lock;
+    std::unordered_map<std::string_view, symbol> ids;      //views of the stored names
+    std::unique_ptr<std::string[]> chunks[MAX_CHUNKS];
+    std::atomic<size_t> count{0};
+};
+
+symbol_table& symbols() {
+    static symbol_table table;
+    return table;
+}
+
+symbol intern(std::string_view name) {
+    return symbols().intern(name);
+}
+
+const std::string& symbol_name(symbol id) {
+    return symbols().name(id);
+}
+
+//Trivially copyable: the program is a symbol, so copying a PCB into a wait queue does not allocate
+struct PCB{
+    unsigned int    PID;
+    int             PPID;
+    symbol          program;
+    unsigned int    size;
+    int             partition_number;
+
+    PCB(unsigned int _pid, int _ppid, symbol _program, unsigned int _size, int _part_num):
+        PID(_pid), PPID(_ppid), program(_program), size(_size), partition_number(_part_num) {}
+};
+
+static_assert(std::is_trivially_copyable<PCB>::value, "PCB must stay trivially copyable");
+
+/*
+    Persistent wait queue. Entries are immutable nodes linked from the newest to
+    the oldest, so pushing returns a new queue that shares every existing node
+    with the old one: O(1) time and no copies, and any queue can be kept as a
+    free snapshot. Iteration is oldest first, the order the queue was filled in.
+*/
+class wait_queue {
+public:
+    wait_queue() = default;
+    wait_queue(const wait_queue&) = default;
+    wait_queue(wait_queue&&) = default;
+    wait_queue& operator=(const wait_queue&) = default;
+    wait_queue& operator=(wait_queue&&) = default;
+
+    //Unlinks nodes nobody else shares one at a time, so long queues don't recurse on destruction
+    ~wait_queue() {
+        while(head && head.use_count() == 1) {
+            std::shared_ptr<const node> older = head->older;
+            head = std::move(older);
+        }
+    }
+
+    //A new queue with pcb added at the back; this queue is unchanged
+    wait_queue push(const PCB& pcb) const {
+        unsigned int max_pid = head ? std::max(head->max_pid, pcb.PID) : pcb.PID;
+        return wait_queue(std::make_shared<const node>(node{pcb, head, size() + 1, max_pid}));
+    }
+
+    size_t size() const {
+        return head ? head->length : 0;
+    }
+
+    bool empty() const {
+        return head == nullptr;
+    }
+
+    //Largest PID in the queue; only meaningful when the queue is not empty
+    unsigned int max_pid() const {
+        return head ? head->max_pid : 0;
+    }
+
+    //The queue without any entry for pid. Shares this queue when pid is not in it.
+    wait_queue without(unsigned int pid) const {
+        bool found = false;
+        for(const node* entry = head.get(); entry != nullptr; entry = entry->older.get()) {
+            found = found || entry->pcb.PID == pid;
+        }
+        if(!found) {
+            return *this;
+        }
+
+        wait_queue filtered;
+        for_each([&](const PCB& pcb) {
+            if(pcb.PID != pid) {
+                filtered = filtered.push(pcb);
+            }
+        });
+        return filtered;
+    }
+
+    //True if both queues hold the same PCBs in the same order; shared tails are not walked twice
+    bool same_as(const wait_queue& other) const {
+        if(size() != other.size()) {
+            return false;
+        }
+        const node* a = head.get();
+        const node* b = other.head.get();
+        for(; a != b; a = a->older.get(), b = b->older.get()) {
+            if(a->pcb.PID != b->pcb.PID || a->pcb.PPID != b->pcb.PPID || a->pcb.size != b->pcb.size
+               || a->pcb.partition_number != b->pcb.partition_number || a->pcb.program != b->pcb.program) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //Calls visit for every PCB, oldest first
+    template<typename Visit>
+    void for_each(Visit visit) const {
+        const node* stack_nodes[32];
+        std::vector<const node*> heap_nodes;
+        const node** nodes = stack_nodes;
+        if(size() > 32) {
+            heap_nodes.resize(size());
+            nodes = heap_nodes.data();
+        }
+
+        size_t k = size();
+        for(const node* entry = head.get(); entry != nullptr; entry = entry->older.get()) {
+            nodes[--k] = entry;
+        }
+        for(size_t j = 0; j < size(); j++) {
+            visit(nodes[j]->pcb);
+        }
+    }
+
+private:
+    struct node {
+        PCB                         pcb;
+        std::shared_ptr<const node> older;
+        size_t                      length;
+        unsigned int                max_pid;
+    };
+
+    std::shared_ptr<const node> head;
+
+    explicit wait_queue(std::shared_ptr<const node> _head) : head(std::move(_head)) {}
+};
+
+struct external_file{
+    symbol          program;
+    unsigned int    size;
+};
+
+/*
+    The programs listed in external_files.txt. Each one gets a dense integer id
+    (its position in the file, duplicates skipped) and names are looked up
+    through a hash table, so the engine never searches the list by name.
+*/
+class program_registry {
+public:
+    //Adds a program and returns its id, or the existing id if the name is already registered
+    int add(const std::string& program_name, unsigned int size) {
+        auto [it, inserted] = ids.emplace(program_name, entries.size());
+        if(inserted) {
+            entries.push_back(external_file{intern(program_name), size});
+        }
+        return it->second;
+    }
+
+    //Id of a program, -1 if it is not registered
+    int find(const std::string& program_name) const {
+        auto it = ids.find(program_name);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    //Same lookup for a name still inside the trace text; the key buffer is reused, so it does not allocate
+    int find(std::string_view program_name) const {
+        thread_local std::string key;
+        key.assign(program_name.data(), program_name.size());
+        return find(key);
+    }
+
+    const external_file& operator[](int id) const {
+        return entries[id];
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    const std::vector<external_file>& files() const {
+        return entries;
+    }
+
+private:
+    std::vector<external_file> entries;
+    std::unordered_map<std::string, int> ids;
+};
+
+//Allocates a program to memory (if there is space)
+//returns true if the allocation was sucessful, false if not.
+bool allocate_memory(PCB* current, partition_manager& memory) {
+    STATS_TIMER(ALLOCATION);
+    //Start from the last (smallest) partition and take the first one that fits
+    int partition_number = memory.last_fit(current->size);
+    if(partition_number == -1) {
+        return false;
+    }
+    current->partition_number = partition_number;
+    memory.occupy(partition_number, current->PID, current->size);
+    return true;
+}
+
+//Partition for a FORK child or an EXEC'd program, as the placement policy picks it; -1 if none fits
+template<typename Memory>
+int find_partition(const Memory& memory, unsigned int size) {
+    STATS_TIMER(ALLOCATION);
+    return memory.place(size);
+}
+
+//frees the memory given PCB.
+void free_memory(PCB* process, partition_manager& memory) {
+    memory.release(process->partition_number);
+    process->partition_number = -1;
+}
+
+// Helper function for splitting strings; every token is a copy, so it is meant for short input like options
+std::vector<std::string> split_delim(std::string_view input, std::string_view delim) {
+    std::vector<std::string> tokens;
+    std::size_t start = 0;
+    std::size_t pos = 0;
+    while ((pos = input.find(delim, start)) != std::string_view::npos) {
+        tokens.emplace_back(input.substr(start, pos - start));
+        start = pos + delim.length();
+    }
+    tokens.emplace_back(input.substr(start));
+
+    return tokens;
+}
+
+/*
+    A whole input file in memory. Regular files are memory-mapped read-only;
+    anything that cannot be mapped (pipes, empty files, Windows) is read into a
+    buffer instead. Either way text() is the file's bytes, which the readers
+    below tokenise in place with string_views.
+*/
+class mapped_file {
+public:
+    mapped_file() = default;
+
+    //Opens path or throws simulator_error
+    explicit mapped_file(const std::string& path) {
+        if(!open(path)) {
+            throw simulator_error("Unable to open file: " + path);
+        }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+        close();
+    }
+
+    //Returns false if the file cannot be opened
+    bool open(const std::string& path) {
+        close();
+        name = path;
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(address != MAP_FAILED) {
+                madvise(address, info.st_size, MADV_SEQUENTIAL);
+                mapping = static_cast<const char*>(address);
+                length = info.st_size;
+                ::close(fd);
+                return true;
+            }
+        }
+        char chunk[64 * 1024];
+        for(ssize_t got; (got = read(fd, chunk, sizeof(chunk))) > 0;) {
+            buffer.append(chunk, got);
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream input(path, std::ios::binary);
+        if(!input.is_open()) {
+            return false;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        return true;
+#endif
+    }
+
+    std::string_view text() const {
+        return mapping != nullptr ? std::string_view(mapping, length) : std::string_view(buffer);
+    }
+
+    const std::string& path() const {
+        return name;
+    }
+
+private:
+    std::string name;
+    const char* mapping = nullptr;
+    size_t length = 0;
+    std::string buffer;
+
+    void close() {
+#ifndef _WIN32
+        if(mapping != nullptr) {
+            munmap(const_cast<char*>(mapping), length);
+        }
+#endif
+        mapping = nullptr;
+        length = 0;
+        buffer.clear();
+    }
+};
+
+//Calls visit(line, line_number) for every line of text, split the way std::getline splits a file
+template<typename Visit>
+void for_each_line(std::string_view text, Visit visit) {
+    int line_number = 0;
+    size_t start = 0;
+    while(start < text.size()) {
+        size_t end = text.find('\n', start);
+        if(end == std::string_view::npos) {
+            end = text.size();
+        }
+        visit(text.substr(start, end - start), ++line_number);
+        start = end + 1;
+    }
+}
+
+//Number of lines for_each_line will visit
+size_t count_lines(std::string_view text) {
+    size_t lines = std::count(text.begin(), text.end(), '\n');
+    return lines + (!text.empty() && text.back() != '\n');
+}
+
+//True for lines with nothing but spaces, tabs and a carriage return
+bool is_blank(std::string_view line) {
+    return line.find_first_not_of(" \t\r") == std::string_view::npos;
+}
+
+//line without the spaces, tabs and carriage returns around it
+std::string_view trim(std::string_view line) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == std::string_view::npos) {
+        return std::string_view();
+    }
+    return line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+}
+
+/*
+    Reads an int the way std::stoi does, without allocating: leading whitespace
+    and a sign are accepted and anything after the digits is ignored.
+    returns false when there are no digits or the number does not fit an int
+*/
+bool parse_int(std::string_view text, int& value) {
+    size_t start = 0;
+    while(start < text.size() && std::isspace(static_cast<unsigned char>(text[start]))) {
+        start++;
+    }
+    if(start < text.size() && text[start] == '+') {
+        start++;
+        if(start == text.size() || !std::isdigit(static_cast<unsigned char>(text[start]))) {
+            return false;
+        }
+    }
+    const char* first = text.data() + start;
+    auto [end, error] = std::from_chars(first, text.data() + text.size(), value);
+    return error == std::errc() && end != first;
+}
+
+//"path:line" for error messages
+std::string source_line(const std::string& path, int line_number) {
+    return path + ":" + std::to_string(line_number);
+}
+
+//Reads the vector table: one ISR address per line, indexed by interrupt number
+std::vector<std::string> load_vector_table(const std::string& path) {
+    mapped_file input_file(path);
+
+    std::vector<std::string> vectors;
+    vectors.reserve(count_lines(input_file.text()));
+    for_each_line(input_file.text(), [&](std::string_view vector, int) {
+        vectors.emplace_back(vector);
+    });
+    return vectors;
+}
+
+//Reads the device table: one ISR delay per line, indexed by device number
+std::vector<int> load_device_table(const std::string& path) {
+    mapped_file input_file(path);
+
+    std::vector<int> delays;
+    for_each_line(input_file.text(), [&](std::string_view duration, int line_number) {
+        int delay = 0;
+        if(!parse_int(duration, delay)) {
+            throw simulator_error(source_line(path, line_number) + ": invalid delay: " + std::string(duration));
+        }
+        delays.push_back(delay);
+    });
+    return delays;
+}
+
+//Reads external_files.txt into a registry; bad lines are errors, duplicates keep the first entry
+program_registry load_external_files(const std::string& path, std::ostream& warnings = std::cerr) {
+    mapped_file input_file(path);
+
+    //Each line is "<program name>,<size in Mb>"
+    program_registry external_files;
+    for_each_line(input_file.text(), [&](std::string_view file_content, int line_number) {
+        if(is_blank(file_content)) {
+            return;
+        }
+
+        size_t comma = file_content.find(',');
+        std::string_view program_name = file_content.substr(0, comma);
+        int size = 0;
+        bool valid = comma != std::string_view::npos && comma > 0
+                  && file_content.find(',', comma + 1) == std::string_view::npos
+                  && parse_int(file_content.substr(comma + 1), size);
+        if(!valid || size <= 0) {
+            throw simulator_error(source_line(path, line_number) + ": malformed external file entry: " + std::string(file_content));
+        }
+
+        if(external_files.find(program_name) != -1) {
+            warnings << "Warning: " << source_line(path, line_number) << ": duplicate entry for " << program_name
+                     << ", keeping the first one" << std::endl;
+            return;
+        }
+        external_files.add(std::string(program_name), size);
+    });
+    return external_files;
+}
+
+/**
+ * \brief parse the CLI arguments
+ *
+ * This helper function parses command line arguments and checks for errors 
+ * 
+ * @param argc number of command line arguments
+ * @param argv the command line arguments
+ * @return a vector of strings (the parsed vector table), a vector of delays, a vector of external files
+ * 
+ */
+std::tuple<std::vector<std::string>, std::vector<int>, program_registry>parse_args(int argc, char** argv) {
+    if(argc < 5) {
+        std::cout << "ERROR!\nExpected 4 argument, received " << argc - 1 << std::endl;
+        std::cout << "To run the program, do: ./interrutps <your_trace_file.txt> <your_vector_table.txt> <your_device_table.txt> <your_external_files.txt> [options]" << std::endl;
+        std::cout << "Options: --execution <file|->  --status <file|->  --status-at <time>  --binary <file>  --partitions <file>" << std::endl;
+        std::cout << "Batch:   --batch (first argument is a manifest of trace,execution,status[,partitions] lines)  --jobs <n>  --summary <file>" << std::endl;
+        std::cout << "Serve:   --serve (first argument is a Unix socket path, or - for stdin/stdout; RUN <id> <bytes> requests)  --jobs <n>" << std::endl;
+        std::cout << "Stats:   --stats (report at exit)  --stats-json <file|->" << std::endl;
+        std::cout << "Timing:  --context-save <t>  --context-restore <t> (default 10 each)" << std::endl;
+        std::cout << "Memo:    --memo-exec (replay repeated EXECs from a cache; classic engine only)" << std::endl;
+        std::cout << "Memory:  --memory-mode <fixed|buddy|free-list>  --memory-size <Mb> (dynamic modes, default 100)" << std::endl;
+        std::cout << "         --placement <best|first|worst|next> (fixed mode, default best)" << std::endl;
+        std::cout << "Analytics: --analytics <file|-> (utilisation and fragmentation summary; classic engine only)" << std::endl;
+        std::cout << "SMP:     --cores <n> (one execution log per core: <execution>_core<k>)  --async-io (devices run in the background)" << std::endl;
+        exit(1);
+    }
+
+    //The trace (argv[1]) is opened once, when it is run
+    try {
+        return {load_vector_table(argv[2]), load_device_table(argv[3]), load_external_files(argv[4])};
+    } catch(const simulator_error& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        exit(1);
+    }
+}
+
+//Cost of saving and restoring the CPU context on an interrupt
+struct interrupt_timing {
+    int context_save = 10;
+    int context_restore = 10;
+};
+
+//Optional settings that follow the 4 positional arguments
+struct run_options {
+    std::string execution_path  = "output_files/execution_5.txt";  //"-" for stdout
+    std::string status_path     = "output_files/system_status_5.txt";
+    int         status_time = -1;   //--status-at: only write the status table in effect at this time
+    std::string binary_path;    //when set, a binary event log is written instead of the text files
+    std::string partitions_path;    //one partition size (Mb) per line; the default layout when empty
+    bool        batch = false;      //the trace argument is a manifest of jobs to run in parallel
+    bool        serve = false;      //the trace argument is a socket path (or "-") to take traces from
+    unsigned    jobs = 0;           //worker threads for --batch and --serve, 0 for one per core
+    std::string summary_path;       //CSV summary of a batch run
+    interrupt_timing timing;        //--context-save / --context-restore
+    bool        stats = false;      //print run statistics at exit
+    std::string stats_json_path;    //run statistics as JSON ("-" for stdout); implies stats
+    unsigned    cores = 0;          //--cores: simulate an SMP machine with this many CPUs, 0 for the classic model
+    bool        memo_exec = false;  //--memo-exec: replay EXECs that start from a state seen before
+    bool        async_io = false;   //--async-io: SYSCALL blocks the process until its device finishes (SMP engine, 1 core by default)
+    std::string analytics_path;     //--analytics: utilisation and fragmentation summary ("-" for stdout)
+    memory_mode memory = memory_mode::FIXED;    //--memory-mode
+    unsigned    memory_size = 100;  //--memory-size: Mb handed out by the dynamic allocators
+    placement_policy placement = placement_policy::BEST_FIT;   //--placement
+};
+
+//Parses the options after the positional arguments of parse_args
+run_options parse_options(int argc, char** argv) {
+    run_options options;
+
+    for(int i = 5; i < argc; i++) {
+        std::string option = argv[i];
+        if(option == "--batch") {
+            options.batch = true;
+            continue;
+        }
+        if(option == "--serve") {
+            options.serve = true;
+            continue;
+        }
+        if(option == "--stats") {
+            options.stats = true;
+            continue;
+        }
+        if(option == "--memo-exec") {
+            options.memo_exec = true;
+            continue;
+        }
+        if(option == "--async-io") {
+            options.async_io = true;
+            continue;
+        }
+        if(i + 1 >= argc) {
+            std::cerr << "Error: Missing value for option " << option << std::endl;
+            exit(1);
+        }
+
+        if(option == "--execution") {
+            options.execution_path = argv[++i];
+        } else if(option == "--status") {
+            options.status_path = argv[++i];
+        } else if(option == "--binary") {
+            options.binary_path = argv[++i];
+        } else if(option == "--partitions") {
+            options.partitions_path = argv[++i];
+        } else if(option == "--jobs") {
+            try {
+                options.jobs = std::stoul(argv[++i]);
+            } catch(const std::exception&) {
+                std::cerr << "Error: --jobs expects a number, got " << argv[i] << std::endl;
+                exit(1);
+            }
+        } else if(option == "--summary") {
+            options.summary_path = argv[++i];
+        } else if(option == "--status-at") {
+            try {
+                options.status_time = std::stoi(argv[++i]);
+                if(options.status_time < 0) {
+                    throw std::invalid_argument(argv[i]);
+                }
+            } catch(const std::exception&) {
+                std::cerr << "Error: --status-at expects a time >= 0, got " << argv[i] << std::endl;
+                exit(1);
+            }
+        } else if(option == "--context-save" || option == "--context-restore") {
+            int& target = option == "--context-save" ? options.timing.context_save : options.timing.context_restore;
+            try {
+                target = std::stoi(argv[++i]);
+                if(target < 0) {
+                    throw std::invalid_argument(argv[i]);
+                }
+            } catch(const std::exception&) {
+                std::cerr << "Error: " << option << " expects a time >= 0, got " << argv[i] << std::endl;
+                exit(1);
+            }
+        } else if(option == "--cores") {
+            try {
+                options.cores = std::stoul(argv[++i]);
+                if(options.cores < 1 || options.cores > 1024) {
+                    throw std::out_of_range(argv[i]);
+                }
+            } catch(const std::exception&) {
+                std::cerr << "Error: --cores expects a number from 1 to 1024, got " << argv[i] << std::endl;
+                exit(1);
+            }
+        } else if(option == "--stats-json") {
+            options.stats_json_path = argv[++i];
+            options.stats = true;
+        } else if(option == "--analytics") {
+            options.analytics_path = argv[++i];
+        } else if(option == "--memory-mode") {
+            std::string mode = argv[++i];
+            if(mode == "fixed") {
+                options.memory = memory_mode::FIXED;
+            } else if(mode == "buddy") {
+                options.memory = memory_mode::BUDDY;
+            } else if(mode == "free-list") {
+                options.memory = memory_mode::FREE_LIST;
+            } else {
+                std::cerr << "Error: --memory-mode expects fixed, buddy or free-list, got " << mode << std::endl;
+                exit(1);
+            }
+        } else if(option == "--placement") {
+            std::string policy = argv[++i];
+            if(policy == "best") {
+                options.placement = placement_policy::BEST_FIT;
+            } else if(policy == "first") {
+                options.placement = placement_policy::FIRST_FIT;
+            } else if(policy == "worst") {
+                options.placement = placement_policy::WORST_FIT;
+            } else if(policy == "next") {
+                options.placement = placement_policy::NEXT_FIT;
+            } else {
+                std::cerr << "Error: --placement expects best, first, worst or next, got " << policy << std::endl;
+                exit(1);
+            }
+        } else if(option == "--memory-size") {
+            try {
+                options.memory_size = std::stoul(argv[++i]);
+                if(options.memory_size < 1 || options.memory_size > 1048576) {
+                    throw std::out_of_range(argv[i]);
+                }
+            } catch(const std::exception&) {
+                std::cerr << "Error: --memory-size expects a number of Mb from 1 to 1048576, got " << argv[i] << std::endl;
+                exit(1);
+            }
+        } else {
+            std::cerr << "Error: Unknown option " << option << std::endl;
+            exit(1);
+        }
+    }
+
+    //Asynchronous devices need the event-driven SMP engine
+    if(options.async_io && options.cores == 0) {
+        options.cores = 1;
+    }
+
+    if(options.memory != memory_mode::FIXED && !options.partitions_path.empty()) {
+        std::cerr << "Error: --partitions only applies to --memory-mode fixed" << std::endl;
+        exit(1);
+    }
+    if(options.memory != memory_mode::FIXED && options.placement != placement_policy::BEST_FIT) {
+        std::cerr << "Error: --placement only applies to --memory-mode fixed" << std::endl;
+        exit(1);
+    }
+
+    return options;
+}
+
+//Reads a partition table: one size per line, partition numbers follow the line order
+std::vector<unsigned int> load_partition_layout(const std::string& path) {
+    mapped_file input_file(path);
+
+    std::vector<unsigned int> sizes;
+    for_each_line(input_file.text(), [&](std::string_view line, int line_number) {
+        if(is_blank(line)) {
+            return;
+        }
+        int size = 0;
+        if(!parse_int(line, size) || size <= 0) {
+            throw simulator_error(source_line(path, line_number) + ": invalid partition size: " + std::string(line));
+        }
+        sizes.push_back(size);
+    });
+
+    if(sizes.empty()) {
+        throw simulator_error(path + ": no partitions defined");
+    }
+    return sizes;
+}
+
+//One line of a batch manifest: trace, execution output, status output and an optional partition layout
+struct batch_job {
+    std::string trace_path;
+    std::string execution_path;
+    std::string status_path;
+    std::string partitions_path;
+};
+
+//What a batch job reports back; a failed job has ok == false and says why in error
+struct batch_result {
+    bool        ok = false;
+    std::string error;
+    int         end_time = 0;
+    size_t      events = 0;
+    size_t      execution_bytes = 0;
+    size_t      status_bytes = 0;
+    double      milliseconds = 0;
+};
+
+/*
+    Reads a batch manifest, one job per line:
+        trace_file, execution_file, system_status_file[, partitions_file]
+    Blank lines and lines starting with '#' are skipped.
+*/
+std::vector<batch_job> load_batch_manifest(const std::string& path) {
+    mapped_file input_file(path);
+
+    std::vector<batch_job> jobs;
+    for_each_line(input_file.text(), [&](std::string_view line, int line_number) {
+        std::string_view content = trim(line);
+        if(content.empty() || content[0] == '#') {
+            return;
+        }
+
+        std::string_view fields[5];
+        size_t count = 0;
+        for(size_t start = 0; count < 5; count++) {
+            size_t comma = line.find(',', start);
+            fields[count] = trim(line.substr(start, comma == std::string_view::npos ? std::string_view::npos : comma - start));
+            if(comma == std::string_view::npos) {
+                count++;
+                break;
+            }
+            start = comma + 1;
+        }
+        if(count < 3 || count > 4 || fields[0].empty() || fields[1].empty() || fields[2].empty()) {
+            throw simulator_error(source_line(path, line_number)
+                                  + ": expected trace,execution,status[,partitions]: " + std::string(line));
+        }
+        jobs.push_back(batch_job{std::string(fields[0]), std::string(fields[1]), std::string(fields[2]),
+                                 count == 4 ? std::string(fields[3]) : ""});
+    });
+    return jobs;
+}
+
+//Activities understood by the simulator. INVALID covers malformed and unknown lines.
+enum class opcode : uint8_t {
+    CPU,
+    SYSCALL,
+    END_IO,
+    FORK,
+    IF_CHILD,
+    IF_PARENT,
+    ENDIF,
+    EXEC,
+    INVALID
+};
+
+//One compiled trace line
+struct instruction {
+    opcode  op;
+    int     operand;    //duration or interrupt number
+    int     program;    //program id for EXEC, -1 otherwise
+};
+
+//Where a FORK sends the child and where the parent picks up again
+struct fork_entry {
+    int     child_block;    //block holding the child's trace, -1 if the child has nothing to run
+    size_t  parent_index;   //index the parent jumps to (the loop then moves past it)
+};
+
+//A run of consecutive instructions of the instruction store: [begin, end)
+struct code_span {
+    uint32_t    begin;
+    uint32_t    end;
+};
+
+/*
+    A block is a view of its trace's instruction store: the runs of it the
+    block executes, in order. FORK children are views of the same store, so a
+    child costs one span per run of lines it keeps instead of a copy of them.
+    Instructions are addressed by their index in the block, as if the block
+    were a plain array; locate() turns that into a store index.
+*/
+struct trace_block {
+    std::vector<code_span>  spans;
+    std::vector<size_t>     offsets;    //block index of the first instruction of each span
+    size_t                  length = 0;
+    std::vector<std::pair<size_t, fork_entry>> forks;  //by store index of the FORK, in store order
+
+    size_t size() const {
+        return length;
+    }
+
+    //Adds store[begin, end) at the end of the block, extending the last span when they touch
+    void append(size_t begin, size_t end) {
+        if(begin == end) {
+            return;
+        }
+        if(!spans.empty() && spans.back().end == begin) {
+            spans.back().end = end;
+        } else {
+            spans.push_back(code_span{static_cast<uint32_t>(begin), static_cast<uint32_t>(end)});
+            offsets.push_back(length);
+        }
+        length += end - begin;
+    }
+
+    /*
+        Store index of instruction ip. span is the caller's cursor: the span the
+        previous lookup ended in. Stepping through the block moves it along in
+        O(1); a jump falls back to a binary search.
+    */
+    size_t locate(size_t ip, size_t& span) const {
+        if(span >= spans.size() || ip < offsets[span] || ip - offsets[span] >= spans[span].end - spans[span].begin) {
+            if(span + 1 < spans.size() && ip == offsets[span + 1]) {
+                span++;
+            } else {
+                span = std::upper_bound(offsets.begin(), offsets.end(), ip) - offsets.begin() - 1;
+            }
+        }
+        return spans[span].begin + (ip - offsets[span]);
+    }
+
+    //Fork table entry of the FORK at a store index; FORKs the block never reaches send the parent to index 1
+    const fork_entry& fork_at(size_t store_index) const {
+        static const fork_entry unreachable{-1, 0};
+        auto it = std::lower_bound(forks.begin(), forks.end(), store_index,
+                                   [](const std::pair<size_t, fork_entry>& entry, size_t index) { return entry.first < index; });
+        return it != forks.end() && it->first == store_index ? it->second : unreachable;
+    }
+};
+
+/*
+    A whole trace compiled once: one instruction store, block 0 is the trace
+    itself, the rest are FORK children. Every line compiles to one instruction,
+    so store index k is line k + 1 of source.
+*/
+struct compiled_trace {
+    std::vector<instruction>    code;
+    std::vector<trace_block>    blocks;
+    std::string                 source;
+};
+
+//Sizes of the tables a trace's interrupt numbers index: SYSCALL and END_IO use both
+struct interrupt_tables {
+    size_t  vectors;
+    size_t  devices;
+};
+
+/*
+    Turns a single trace line, "<activity>, <duration or interrupt number>" or
+    "EXEC <program>, <duration>", into an instruction. The line is tokenised in
+    place; EXEC names are resolved to registry ids. A line without a comma is
+    reported to warnings and compiled as INVALID, which the engine skips; a
+    blank line is compiled the same way without a word. An interrupt number
+    outside the vector or device table is an error. Messages name the line as
+    source:line_number.
+*/
+instruction compile_line(std::string_view line, const program_registry& registry, const interrupt_tables& tables,
+                         const std::string& source = "trace", int line_number = 0, std::ostream& warnings = std::cerr) {
+    if(is_blank(line)) {
+        return instruction{opcode::INVALID, -1, -1};
+    }
+    size_t comma = line.find(',');
+    if(comma == std::string_view::npos) {
+        warnings << "Error: " << source_line(source, line_number) << ": Malformed input line: " << line << std::endl;
+        return instruction{opcode::INVALID, -1, -1};
+    }
+
+    std::string_view activity = line.substr(0, comma);
+    size_t next = line.find(',', comma + 1);
+    int duration_intr = 0;
+    if(!parse_int(line.substr(comma + 1, next == std::string_view::npos ? std::string_view::npos : next - comma - 1), duration_intr)) {
+        throw simulator_error(source_line(source, line_number) + ": invalid number: " + std::string(line));
+    }
+
+    //"EXEC <program>": the name runs up to the next space
+    std::string_view program_name;
+    size_t space = activity.find(' ');
+    if(activity.substr(0, space) == "EXEC") {
+        program_name = space == std::string_view::npos ? std::string_view() : activity.substr(space + 1);
+        program_name = program_name.substr(0, program_name.find(' '));
+        activity = "EXEC";
+    }
+
+    instruction ins{opcode::INVALID, duration_intr, -1};
+    if(activity == "CPU") {
+        ins.op = opcode::CPU;
+    } else if(activity == "SYSCALL") {
+        ins.op = opcode::SYSCALL;
+    } else if(activity == "END_IO") {
+        ins.op = opcode::END_IO;
+    } else if(activity == "FORK") {
+        ins.op = opcode::FORK;
+    } else if(activity == "IF_CHILD") {
+        ins.op = opcode::IF_CHILD;
+    } else if(activity == "IF_PARENT") {
+        ins.op = opcode::IF_PARENT;
+    } else if(activity == "ENDIF") {
+        ins.op = opcode::ENDIF;
+    } else if(activity == "EXEC") {
+        ins.op = opcode::EXEC;
+        ins.program = registry.find(program_name);    //-1 makes the EXEC report "Program not found"
+    }
+
+    //FORK and EXEC always go through vectors 2 and 3
+    if(ins.op == opcode::FORK || ins.op == opcode::EXEC) {
+        int vector = ins.op == opcode::FORK ? 2 : 3;
+        if(static_cast<size_t>(vector) >= tables.vectors) {
+            throw simulator_error(source_line(source, line_number) + ": " + std::string(ins.op == opcode::FORK ? "FORK" : "EXEC") + " needs interrupt "
+                                  + std::to_string(vector) + ", which is not in the vector table ("
+                                  + std::to_string(tables.vectors) + " entries)");
+        }
+    }
+
+    if(ins.op == opcode::SYSCALL || ins.op == opcode::END_IO) {
+        if(duration_intr < 0 || static_cast<size_t>(duration_intr) >= tables.vectors) {
+            throw simulator_error(source_line(source, line_number) + ": interrupt " + std::to_string(duration_intr)
+                                  + " is not in the vector table (" + std::to_string(tables.vectors) + " entries)");
+        }
+        if(static_cast<size_t>(duration_intr) >= tables.devices) {
+            throw simulator_error(source_line(source, line_number) + ": device " + std::to_string(duration_intr)
+                                  + " is not in the device table (" + std::to_string(tables.devices) + " entries)");
+        }
+    }
+
+    return ins;
+}
+
+/*
+    Extracts the child's trace for the FORK at index i of block and finds where
+    the parent resumes. The child gets the lines after IF_CHILD (up to and
+    including an EXEC) plus whatever follows ENDIF; the parent resumes at the
+    last IF_PARENT seen. The child is built as spans of the same store.
+    next_marker[p] is the first store index >= p holding IF_CHILD, IF_PARENT,
+    ENDIF or EXEC, so runs of plain lines are skipped or taken whole.
+*/
+size_t extract_fork_child(const std::vector<instruction>& code, const trace_block& block,
+                          const std::vector<size_t>& next_marker, size_t i, trace_block& child) {
+    STATS_TIMER(FORK_EXTRACTION);
+    bool skip = true;
+    bool exec_flag = false;
+    size_t parent_index = 0;
+
+    size_t span = 0;
+    size_t j = i;
+    while(j < block.size()) {
+        //The next marker at or after j, in block indexes; runs of plain lines end with their span
+        size_t at = block.locate(j, span);
+        size_t span_end = block.spans[span].end;
+        size_t marker = std::min(next_marker[at], span_end);
+        if(!skip) {
+            child.append(at, marker);
+        }
+        j += marker - at;
+        if(marker == span_end) {
+            continue;
+        }
+
+        opcode op = code[marker].op;
+        if(skip && op == opcode::IF_CHILD) {
+            skip = false;
+        } else if(op == opcode::IF_PARENT) {
+            skip = true;
+            parent_index = j;
+            if(exec_flag) {
+                break;
+            }
+        } else if(skip && op == opcode::ENDIF) {
+            skip = false;
+        } else if(!skip && op == opcode::EXEC) {
+            skip = true;
+            child.append(marker, marker + 1);
+            exec_flag = true;
+        } else if(!skip) {
+            child.append(marker, marker + 1);
+        }
+        j++;
+    }
+
+    return parent_index;
+}
+
+/*
+    Builds the fork table of every block, adding FORK children as new blocks
+    as they appear. Only FORKs the block can actually reach are expanded: the walk
+    follows the same jumps the engine makes (a FORK resumes after its parent index,
+    an EXEC ends the block), so FORKs inside skipped parent/child sections do not
+    get child blocks of their own.
+*/
+void build_fork_tables(compiled_trace& trace) {
+    const std::vector<instruction>& code = trace.code;
+
+    //Both are store-wide, so every block shares them
+    std::vector<size_t> next_marker(code.size() + 1, code.size());
+    std::vector<size_t> next_branch(code.size() + 1, code.size());   //first FORK or EXEC at or after the index
+    for(size_t p = code.size(); p-- > 0;) {
+        opcode op = code[p].op;
+        bool is_marker = op == opcode::IF_CHILD || op == opcode::IF_PARENT
+                      || op == opcode::ENDIF || op == opcode::EXEC;
+        next_marker[p] = is_marker ? p : next_marker[p + 1];
+        next_branch[p] = op == opcode::FORK || op == opcode::EXEC ? p : next_branch[p + 1];
+    }
+
+    std::set<size_t> visited;
+    for(size_t b = 0; b < trace.blocks.size(); b++) {
+        std::vector<std::pair<size_t, fork_entry>> forks;
+        std::vector<trace_block> children;
+        visited.clear();
+
+        const trace_block& block = trace.blocks[b];
+        size_t span = 0;
+        size_t i = 0;
+        while(i < block.size()) {
+            size_t at = block.locate(i, span);
+            size_t branch = std::min(next_branch[at], static_cast<size_t>(block.spans[span].end));
+            i += branch - at;
+            if(branch == block.spans[span].end) {
+                continue;
+            }
+            if(code[branch].op == opcode::EXEC) {
+                break;
+            }
+
+            //A parent index that jumps backwards can revisit a FORK; its entry is already known
+            if(!visited.insert(branch).second) {
+                break;
+            }
+
+            trace_block child;
+            size_t parent_index = extract_fork_child(code, block, next_marker, i, child);
+
+            int child_block = -1;
+            if(child.size() > 0) {
+                child_block = trace.blocks.size() + children.size();
+                children.push_back(std::move(child));
+            }
+            forks.emplace_back(branch, fork_entry{child_block, parent_index});
+            i = parent_index + 1;
+        }
+
+        std::sort(forks.begin(), forks.end(),
+                  [](const std::pair<size_t, fork_entry>& lhs, const std::pair<size_t, fork_entry>& rhs) { return lhs.first < rhs.first; });
+        trace.blocks[b].forks = std::move(forks);
+
+        //appending may move the blocks, so this comes after the last use of block
+        for(auto& child : children) {
+            trace.blocks.push_back(std::move(child));
+        }
+    }
+}
+
+//Compiles the lines of a trace into blocks of instructions plus their fork tables; errors name source:line
+compiled_trace compile_trace(const std::vector<std::string>& lines, const program_registry& registry,
+                             const interrupt_tables& tables, const std::string& source = "trace") {
+    STATS_TIMER(TRACE_PARSING);
+    compiled_trace trace;
+    trace.source = source;
+    trace.code.reserve(lines.size());
+    for(size_t k = 0; k < lines.size(); k++) {
+        trace.code.push_back(compile_line(lines[k], registry, tables, source, k + 1));
+    }
+
+    trace.blocks.emplace_back();
+    trace.blocks[0].append(0, trace.code.size());
+    build_fork_tables(trace);
+    return trace;
+}
+
+//Same, straight from the text of a trace file: lines are compiled where they are, without copying them
+compiled_trace compile_trace(std::string_view text, const program_registry& registry, const interrupt_tables& tables,
+                             const std::string& source, std::ostream& warnings = std::cerr) {
+    STATS_TIMER(TRACE_PARSING);
+    compiled_trace trace;
+    trace.source = source;
+    trace.code.reserve(count_lines(text));
+    for_each_line(text, [&](std::string_view line, int line_number) {
+        trace.code.push_back(compile_line(line, registry, tables, source, line_number, warnings));
+    });
+
+    trace.blocks.emplace_back();
+    trace.blocks[0].append(0, trace.code.size());
+    build_fork_tables(trace);
+    return trace;
+}
 
-    memory_partition_t(unsigned int _pn, unsigned int _s, std::string _c):
-        partition_number(_pn), size(_s), code(_c) {}
+//A compiled <program>.txt, shared read-only by every EXEC of that program
+struct program_image {
+    bool                                    found;
+    size_t                                  lines;
+    std::shared_ptr<const compiled_trace>   trace;      //nullptr if the image could not be compiled
+    std::string                             problems;   //malformed lines, one message per line
+    std::string                             error;      //why it could not be compiled; thrown by find()
 };
 
-memory_partition_t memory[] = {
-    memory_partition_t(1, 40, "empty"),
-    memory_partition_t(2, 25, "empty"),
-    memory_partition_t(3, 15, "empty"),
-    memory_partition_t(4, 10, "empty"),
-    memory_partition_t(5, 8, "empty"),
-    memory_partition_t(6, 2, "empty")
+/*
+    Loads and compiles the program images named in external_files.txt once, up
+    front. Images are compiled whether or not a trace EXECs them, so problems in
+    an image are kept for the load summary rather than printed on every run. An
+    image that cannot be compiled only fails the runs that actually EXEC it.
+*/
+class program_store {
+public:
+    void load(const program_registry& registry, const interrupt_tables& tables) {
+        images.clear();
+        total_lines = 0;
+        missing = 0;
+
+        for(const auto& file : registry.files()) {
+            program_image image{false, 0, nullptr, {}, {}};
+            mapped_file image_file;
+            if(image_file.open(symbol_name(file.program) + ".txt")) {
+                image.found = true;
+            } else {
+                std::cerr << "Warning: program image not found: " << symbol_name(file.program) << ".txt" << std::endl;
+                missing++;
+            }
+
+            std::ostringstream problems;
+            image.lines = count_lines(image_file.text());
+            try {
+                image.trace = std::make_shared<const compiled_trace>(compile_trace(image_file.text(), registry, tables, image_file.path(), problems));
+            } catch(const simulator_error& error) {
+                image.error = error.what();
+                problems << error.what() << std::endl;
+            }
+            image.problems = problems.str();
+            total_lines += image.lines;
+            images.push_back(std::move(image));
+        }
+    }
+
+    //Returns the compiled image of a registered program id, or nullptr for anything else.
+    //Throws simulator_error for an image that could not be compiled.
+    const compiled_trace* find(int program_id) const {
+        if(program_id < 0 || static_cast<size_t>(program_id) >= images.size()) {
+            return nullptr;
+        }
+        const program_image& image = images[program_id];
+        if(!image.error.empty()) {
+            throw simulator_error(image.error);
+        }
+        return image.trace.get();
+    }
+
+    //Prints how many images were loaded, how big they are, how many are missing and what is wrong with the rest
+    void print_stats(const program_registry& registry, std::ostream& out = std::cout) const {
+        out << "Loaded " << images.size() - missing << " program image(s), "
+            << total_lines << " trace line(s); " << missing << " missing" << std::endl;
+        for(size_t id = 0; id < images.size(); id++) {
+            if(!images[id].found) {
+                out << "  missing: " << symbol_name(registry[id].program) << ".txt" << std::endl;
+            }
+            std::istringstream problems(images[id].problems);
+            std::string problem;
+            while(std::getline(problems, problem)) {
+                std::string_view message(problem);
+                if(message.substr(0, 7) == "Error: ") {
+                    message.remove_prefix(7);   //compile_line's prefix; here it is part of a summary
+                }
+                out << "  " << message << std::endl;
+            }
+        }
+    }
+
+private:
+    std::vector<program_image> images;   //indexed by program id
+    size_t total_lines = 0;
+    size_t missing = 0;
 };
 
-struct PCB{
-    unsigned int    PID;
-    int             PPID;
-    std::string     program_name;
-    unsigned int    size;
-    int             partition_number;
+//Everything a simulation reads but never changes, shared by every process it runs
+struct simulation_context {
+    std::vector<std::string>    vectors;
+    std::vector<int>            delays;
+    interrupt_timing            timing;
+    program_registry            external_files;
+    program_store               programs;
 
-    PCB(unsigned int _pid, int _ppid, std::string _pn, unsigned int _size, int _part_num):
-        PID(_pid), PPID(_ppid), program_name(_pn), size(_size), partition_number(_part_num) {}
+    interrupt_tables tables() const {
+        return interrupt_tables{vectors.size(), delays.size()};
+    }
 };
 
-struct external_file{
-    std::string     program_name;
-    unsigned int    size;
+//A process the engine is running (or waiting to return to), kept on an explicit stack
+struct process_frame {
+    const compiled_trace*   trace;
+    const trace_block*      block;
+    size_t                  ip;                 //next instruction to run
+    size_t                  span;               //cursor for block->locate()
+    PCB                     current;
+    wait_queue              waiting;
+    int                     release_partition;  //freed when the frame above this one returns, -1 for none
+    bool                    memo_recording = false; //an exec_memo recording closes when this frame returns
 };
 
-//Allocates a program to memory (if there is space)
-//returns true if the allocation was sucessful, false if not.
-bool allocate_memory(PCB* current) {
-    for(int i = 5; i >= 0; i--) { //Start from smallest partition
-        //check is the code will fit and if the partition is empty
-        if(memory[i].size >= current->size && memory[i].code == "empty") {
-            current->partition_number = memory[i].partition_number;
-            memory[i].code = current->program_name;
-            return true;
+/*
+    Destination for simulator output. Writes are collected in a fixed-size buffer
+    that is handed to flush_buffer() whenever it fills up, so memory use does not
+    grow with the length of the run.
+*/
+class output_sink {
+public:
+    explicit output_sink(size_t capacity = 64 * 1024) : buffer(capacity), used(0), written(0) {}
+    virtual ~output_sink() = default;
+
+    void write(const char* data, size_t length) {
+        if(used + length > buffer.size()) {
+            flush();
+            if(length >= buffer.size()) {
+                flush_buffer(data, length);
+                written += length;
+                return;
+            }
         }
+        std::copy(data, data + length, buffer.data() + used);
+        used += length;
+        written += length;
     }
-    return false;
-}
 
-//frees the memory given PCB.
-void free_memory(PCB* process) {
-    memory[process->partition_number - 1].code = "empty";
-    process->partition_number = -1;
-}
+    void write(const std::string& text) {
+        write(text.data(), text.size());
+    }
 
-// Following function was taken from stackoverflow; helper function for splitting strings
-std::vector<std::string> split_delim(std::string input, std::string delim) {
-    std::vector<std::string> tokens;
-    std::size_t pos = 0;
-    std::string token;
-    while ((pos = input.find(delim)) != std::string::npos) {
-        token = input.substr(0, pos);
-        tokens.push_back(token);
-        input.erase(0, pos + delim.length());
+    void flush() {
+        if(used > 0) {
+            flush_buffer(buffer.data(), used);
+            used = 0;
+        }
     }
-    tokens.push_back(input);
 
-    return tokens;
-}
+    //Total bytes accepted so far (buffered or not)
+    size_t bytes_written() const {
+        return written;
+    }
 
-/**
- * \brief parse the CLI arguments
- *
- * This helper function parses command line arguments and checks for errors 
- * 
- * @param argc number of command line arguments
- * @param argv the command line arguments
- * @return a vector of strings (the parsed vector table), a vector of delays, a vector of external files
- * 
- */
-std::tuple<std::vector<std::string>, std::vector<int>, std::vector<external_file>>parse_args(int argc, char** argv) {
-    if(argc != 5) {
-        std::cout << "ERROR!\nExpected 4 argument, received " << argc - 1 << std::endl;
-        std::cout << "To run the program, do: ./interrutps <your_trace_file.txt> <your_vector_table.txt> <your_device_table.txt> <your_external_files.txt>" << std::endl;
-        exit(1);
+protected:
+    virtual void flush_buffer(const char* data, size_t length) = 0;
+
+private:
+    std::vector<char> buffer;
+    size_t used;
+    size_t written;
+};
+
+//Streams output into a file, overwriting it
+class file_sink : public output_sink {
+public:
+    explicit file_sink(const std::string& filename) : output_file(filename, std::ios::binary) {}
+
+    ~file_sink() override {
+        flush();
     }
 
-    std::ifstream input_file;
-    input_file.open(argv[1]);
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << argv[1] << std::endl;
-        exit(1);
+    bool is_open() const {
+        return output_file.is_open();
     }
-    input_file.close();
 
-    input_file.open(argv[2]);
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << argv[2] << std::endl;
-        exit(1);
+protected:
+    void flush_buffer(const char* data, size_t length) override {
+        output_file.write(data, length);
     }
 
-    std::string vector;
-    std::vector<std::string> vectors;
-    while(std::getline(input_file, vector)) {
-        vectors.push_back(vector);
+private:
+    std::ofstream output_file;
+};
+
+//Streams output to standard output
+class stdout_sink : public output_sink {
+public:
+    ~stdout_sink() override {
+        flush();
     }
-    input_file.close();
 
-    std::string duration;
-    std::vector<int> delays;
-    input_file.open(argv[3]);
+protected:
+    void flush_buffer(const char* data, size_t length) override {
+        std::cout.write(data, length);
+    }
+};
 
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << argv[3] << std::endl;
-        exit(1);
+//Keeps output in memory; clear() empties it but keeps the allocation for the next run
+class string_sink : public output_sink {
+public:
+    //Everything written so far
+    const std::string& str() {
+        flush();
+        return text;
     }
 
-    while(std::getline(input_file, duration)) {
-        delays.push_back(std::stoi(duration));
+    void clear() {
+        flush();
+        text.clear();
     }
-    input_file.close();
 
-    std::vector<external_file> external_files;
-    input_file.open(argv[4]);
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Unable to open file: " << argv[4] << std::endl;
-        exit(1);
+protected:
+    void flush_buffer(const char* data, size_t length) override {
+        text.append(data, length);
     }
 
-    std::string file_content;
-    while(std::getline(input_file, file_content)) {
-        external_file entry;
-        auto file_info      = split_delim(file_content, ",");
+private:
+    std::string text;
+};
+
+//Opens the sink for a path given on the command line ("-" means stdout)
+std::unique_ptr<output_sink> open_sink(const std::string& path) {
+    if(path == "-") {
+        return std::make_unique<stdout_sink>();
+    }
 
-        entry.program_name  = file_info[0];
-        entry.size          = std::stoi(file_info[1]);
-        external_files.push_back(entry);
+    auto sink = std::make_unique<file_sink>(path);
+    if(!sink->is_open()) {
+        throw simulator_error("Unable to open output file: " + path);
     }
+    return sink;
+}
+
+//Writes an integer into a sink without going through a temporary string
+void write_int(output_sink& sink, long value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    sink.write(digits, result.ptr - digits);
+}
 
-    input_file.close();
+void write_text(output_sink& sink, const char* text) {
+    sink.write(text, std::char_traits<char>::length(text));
+}
 
+//Every kind of line the execution log can contain
+enum class event_kind : uint8_t {
+    KERNEL_MODE,        //switch to kernel mode
+    CONTEXT_SAVED,
+    FIND_VECTOR,        //operand: vector number
+    LOAD_ADDRESS,       //operand: vector number
+    CPU_BURST,
+    SYSCALL_ISR,
+    ENDIO_ISR,
+    RUN_ISR,            //operand: opcode of the interrupt (SYSCALL or END_IO)
+    IRET,
+    CONTEXT_RESTORED,
+    USER_MODE,
+    CLONE_PCB,
+    FORK_ERROR,
+    SCHEDULER,
+    PROGRAM_SIZE,       //operand: program size in Mb
+    LOAD_PROGRAM,
+    MARK_PARTITION,
+    UPDATE_PCB,
+    EXEC_NOT_FOUND,
+    EXEC_NO_PARTITION,
+    PROLOGUE,           //kernel mode, context saved, find vector, load address; operand: vector, duration: context save time
+    EPILOGUE,           //IRET, context restored, user mode; duration: context restore time
+    DISPATCH,           //SMP: a core starts a process from its run queue; operand: PID
+    STEAL,              //SMP: an idle core takes a process from another core's queue; operand: PID
+    IDLE,               //SMP: the core had nothing to run
+    IO_START,           //async I/O: the SYSCALL ISR started the device and blocked the process; operand: PID
+    IO_DONE             //async I/O: the END_IO ISR made the process ready again; operand: PID
+};
 
-    return {vectors, delays, external_files};
+//Number of execution log lines an event stands for
+inline int event_lines(event_kind kind) {
+    return kind == event_kind::PROLOGUE ? 4 : kind == event_kind::EPILOGUE ? 3 : 1;
 }
 
-//Parces each trace and returns a tuple: {Tace activity, duration or interrupt number, program name (if applicable)}
-std::tuple<std::string, int, std::string> parse_trace(std::string trace) {
-    //split line by ','
-    auto parts = split_delim(trace, ",");
-    if (parts.size() < 2) {
-        std::cerr << "Error: Malformed input line: " << trace << std::endl;
-        return {"null", -1, "null"};
+//One line of the execution log, kept in binary form until it is written out
+struct event {
+    int         time;
+    int         duration;
+    event_kind  kind;
+    int         operand;
+};
+
+/*
+    Renders events as the text lines of execution.txt. Numbers go through
+    std::to_chars and text is copied straight into the sink, so rendering a
+    line does not allocate.
+*/
+class event_formatter {
+public:
+    //The lines that depend on the vector are built here, once per vector
+    explicit event_formatter(const std::vector<std::string>& vectors) {
+        for(size_t k = 0; k < vectors.size(); k++) {
+            std::string find_line = ", 1, find vector " + std::to_string(k) + " in memory position 0x";
+            char address[16];
+            snprintf(address, sizeof(address), "%04X", static_cast<unsigned int>(ADDR_BASE + (k * VECTOR_SIZE)));
+            find_lines.push_back(find_line + address + "\n");
+            load_lines.push_back(", 1, load address " + vectors[k] + " into the PC\n");
+        }
+    }
+
+    void render(const event& e, output_sink& sink) const {
+        //Interrupt prologue and epilogue: only the timestamps are written, the rest is template text
+        if(e.kind == event_kind::PROLOGUE) {
+            const std::string& find_line = find_lines.at(e.operand);
+            const std::string& load_line = load_lines.at(e.operand);
+            write_int(sink, e.time);
+            write_text(sink, ", 1, switch to kernel mode\n");
+            write_int(sink, e.time + 1);
+            write_text(sink, ", ");
+            write_int(sink, e.duration);
+            write_text(sink, ", context saved\n");
+            write_int(sink, e.time + 1 + e.duration);
+            sink.write(find_line);
+            write_int(sink, e.time + 2 + e.duration);
+            sink.write(load_line);
+            return;
+        }
+        if(e.kind == event_kind::EPILOGUE) {
+            write_int(sink, e.time);
+            write_text(sink, ", 1, IRET\n");
+            write_int(sink, e.time + 1);
+            write_text(sink, ", ");
+            write_int(sink, e.duration);
+            write_text(sink, ", context restored\n");
+            write_int(sink, e.time + 1 + e.duration);
+            write_text(sink, ", 1, switch to user mode\n");
+            return;
+        }
+
+        write_int(sink, e.time);
+        if(has_duration(e.kind)) {
+            write_text(sink, ", ");
+            write_int(sink, e.duration);
+        }
+
+        switch(e.kind) {
+            case event_kind::FIND_VECTOR:
+                sink.write(find_lines.at(e.operand));
+                return;
+            case event_kind::LOAD_ADDRESS:
+                sink.write(load_lines.at(e.operand));
+                return;
+            case event_kind::RUN_ISR:
+                write_text(sink, ", ");
+                write_text(sink, static_cast<opcode>(e.operand) == opcode::SYSCALL ? "SYSCALL" : "END_IO");
+                write_text(sink, ": run the ISR");
+                break;
+            case event_kind::PROGRAM_SIZE:
+                write_text(sink, ", Program is ");
+                write_int(sink, e.operand);
+                write_text(sink, " Mb large");
+                break;
+            case event_kind::DISPATCH:
+            case event_kind::STEAL:
+                write_text(sink, e.kind == event_kind::DISPATCH ? ", dispatch PID " : ", steal PID ");
+                write_int(sink, e.operand);
+                break;
+            case event_kind::IO_START:
+            case event_kind::IO_DONE:
+                write_text(sink, e.kind == event_kind::IO_START ? ", SYSCALL ISR: device started, PID " : ", END_IO ISR: device done, PID ");
+                write_int(sink, e.operand);
+                write_text(sink, e.kind == event_kind::IO_START ? " blocked" : " ready");
+                break;
+            default:
+                write_text(sink, ", ");
+                write_text(sink, text(e.kind));
+                break;
+        }
+        sink.write("\n", 1);
     }
 
-    auto activity = parts[0];
-    auto duration_intr = std::stoi(parts[1]);
-    std::string extern_file = "null";
+private:
+    std::vector<std::string> find_lines;    //", 1, find vector N in memory position 0xNNNN\n"
+    std::vector<std::string> load_lines;    //", 1, load address <ISR address> into the PC\n"
 
-    auto exec = split_delim(parts[0], " ");
-    if(exec[0] == "EXEC") {
-        extern_file = exec[1];
-        activity = "EXEC";
+    //The error lines are the only ones printed without a duration
+    static bool has_duration(event_kind kind) {
+        return kind != event_kind::FORK_ERROR && kind != event_kind::EXEC_NOT_FOUND
+            && kind != event_kind::EXEC_NO_PARTITION;
     }
 
-    return {activity, duration_intr, extern_file};
+    static const char* text(event_kind kind) {
+        switch(kind) {
+            case event_kind::KERNEL_MODE:       return "switch to kernel mode";
+            case event_kind::CONTEXT_SAVED:     return "context saved";
+            case event_kind::CPU_BURST:         return "CPU Burst";
+            case event_kind::SYSCALL_ISR:       return "SYSCALL ISR (ADD STEPS HERE)";
+            case event_kind::ENDIO_ISR:         return "ENDIO ISR(ADD STEPS HERE)";
+            case event_kind::IRET:              return "IRET";
+            case event_kind::CONTEXT_RESTORED:  return "context restored";
+            case event_kind::USER_MODE:         return "switch to user mode";
+            case event_kind::CLONE_PCB:         return "cloning the PCB";
+            case event_kind::FORK_ERROR:        return "FORK ERROR: No available partition";
+            case event_kind::SCHEDULER:         return "scheduler called";
+            case event_kind::LOAD_PROGRAM:      return "loading program into memory";
+            case event_kind::MARK_PARTITION:    return "marking partition as occupied";
+            case event_kind::UPDATE_PCB:        return "updating PCB";
+            case event_kind::EXEC_NOT_FOUND:    return "EXEC ERROR: Program not found";
+            case event_kind::EXEC_NO_PARTITION: return "EXEC ERROR: No available partition";
+            case event_kind::IDLE:              return "idle";
+            default:                            return "";
+        }
+    }
+};
+
+//Short name of a trace activity, as printed in the system status header
+const char* opcode_name(opcode op) {
+    switch(op) {
+        case opcode::CPU:       return "CPU";
+        case opcode::SYSCALL:   return "SYSCALL";
+        case opcode::END_IO:    return "END_IO";
+        case opcode::FORK:      return "FORK";
+        case opcode::IF_CHILD:  return "IF_CHILD";
+        case opcode::IF_PARENT: return "IF_PARENT";
+        case opcode::ENDIF:     return "ENDIF";
+        case opcode::EXEC:      return "EXEC";
+        default:                return "null";
+    }
 }
 
-//Default interrupt boilerplate
-std::pair<std::string, int> intr_boilerplate(int current_time, int intr_num, int context_save_time, std::vector<std::string> vectors) {
+/*
+    Aggregates kept while the engine runs (--analytics), so utilisation and
+    fragmentation figures need no second pass over the execution log. Every
+    event a run emits and every partition change comes through here; a
+    partition change is timed at the end of the latest event, which is the
+    engine's clock at that point. Runs add up, so a batch can be summarised too.
+*/
+struct run_analytics {
+    //Internal fragmentation buckets (Mb left unused by an allocation): 0, 1, 2-3, 4-7, 8-15, 16-31, 32+
+    static const size_t WASTE_BUCKETS = 7;
+
+    //One partition of a layout, over every run that used that layout
+    struct partition_usage {
+        uint64_t    occupied_time = 0;
+        uint64_t    wasted_time = 0;    //Mb x ms left unused inside the partition
+        uint64_t    allocations = 0;
+    };
+
+    uint64_t    runs = 0;
+    uint64_t    elapsed = 0;            //simulated ms, all runs
+    uint64_t    cpu_time = 0;           //CPU bursts
+    uint64_t    kernel_time = 0;        //interrupt entry and exit, ISRs, FORK and EXEC work
+    uint64_t    idle_time = 0;
+    uint64_t    capacity_time = 0;      //Mb x ms of memory configured
+    uint64_t    allocations = 0;
+    uint64_t    failures = 0;           //FORKs and EXECs that found no partition
+    uint64_t    waste_histogram[WASTE_BUCKETS] = {};
+    std::map<int, uint64_t> isr_time;   //ISR body time by device
+    std::map<std::pair<unsigned int, unsigned int>, partition_usage> partitions;   //by (partition number, size)
+
+    //Starts a run on empty memory; call it before anything is allocated
+    void start_run(const partition_manager& memory) {
+        now = 0;
+        device = -1;
+        capacity = memory.capacity();
+        table.assign(memory.slots(), slot{});
+    }
+
+    //Closes the run at end_time; partitions still occupied count as occupied until then
+    void end_run(int end_time) {
+        now = std::max(now, end_time);
+        for(size_t k = 0; k < table.size(); k++) {
+            close(k);
+        }
+        capacity_time += uint64_t(capacity) * now;
+        table.clear();
+        elapsed += now;
+        runs++;
+    }
 
-    std::string execution = "";
+    void record(const event& e) {
+        int span = e.duration;
+        switch(e.kind) {
+            case event_kind::CPU_BURST:
+                cpu_time += e.duration;
+                break;
+            case event_kind::IDLE:
+                idle_time += e.duration;
+                break;
+            case event_kind::PROLOGUE:
+                span += 3;
+                kernel_time += span;
+                device = e.operand;
+                break;
+            case event_kind::EPILOGUE:
+                span += 2;
+                kernel_time += span;
+                break;
+            case event_kind::SYSCALL_ISR:
+            case event_kind::ENDIO_ISR:
+            case event_kind::RUN_ISR:
+                isr_time[device] += e.duration;
+                kernel_time += e.duration;
+                break;
+            case event_kind::FORK_ERROR:
+            case event_kind::EXEC_NO_PARTITION:
+                failures++;
+                break;
+            default:
+                kernel_time += e.duration;
+                break;
+        }
+        now = std::max(now, e.time + span);
+    }
 
-    execution += std::to_string(current_time) + ", " + std::to_string(1) + ", switch to kernel mode\n";
-    current_time++;
+    void occupy(unsigned int partition_number, unsigned int size, unsigned int used) {
+        if(partition_number == 0 || partition_number > table.size()) {
+            return;
+        }
+        slot& entry = table[partition_number - 1];
+        close(partition_number - 1);
+        entry.size = size;
+        entry.occupied = true;
+        entry.used = std::min(used, size);
+        entry.since = now;
+
+        unsigned int waste = size - entry.used;
+        size_t bucket = 0;
+        for(; bucket + 1 < WASTE_BUCKETS && waste >= (1u << bucket); bucket++) {}
+        waste_histogram[bucket]++;
+        allocations++;
+        partitions[{partition_number, size}].allocations++;
+    }
 
-    execution += std::to_string(current_time) + ", " + std::to_string(context_save_time) + ", context saved\n";
-    current_time += context_save_time;
-    
-    char vector_address_c[10];
-    sprintf(vector_address_c, "0x%04X", (ADDR_BASE + (intr_num * VECTOR_SIZE)));
-    std::string vector_address(vector_address_c);
+    void release(unsigned int partition_number) {
+        if(partition_number != 0 && partition_number <= table.size()) {
+            close(partition_number - 1);
+        }
+    }
+
+    void merge(const run_analytics& other) {
+        runs += other.runs;
+        elapsed += other.elapsed;
+        cpu_time += other.cpu_time;
+        kernel_time += other.kernel_time;
+        idle_time += other.idle_time;
+        capacity_time += other.capacity_time;
+        allocations += other.allocations;
+        failures += other.failures;
+        for(size_t k = 0; k < WASTE_BUCKETS; k++) {
+            waste_histogram[k] += other.waste_histogram[k];
+        }
+        for(const auto& [device_number, time] : other.isr_time) {
+            isr_time[device_number] += time;
+        }
+        for(const auto& [key, usage] : other.partitions) {
+            partition_usage& total = partitions[key];
+            total.occupied_time += usage.occupied_time;
+            total.wasted_time += usage.wasted_time;
+            total.allocations += usage.allocations;
+        }
+    }
 
-    execution += std::to_string(current_time) + ", " + std::to_string(1) + ", find vector " + std::to_string(intr_num) 
-                    + " in memory position " + vector_address + "\n";
-    current_time++;
+private:
+    //A partition of the current run
+    struct slot {
+        unsigned int    size = 0;
+        unsigned int    used = 0;
+        bool            occupied = false;
+        int             since = 0;
+    };
+
+    int now = 0;                //end of the latest event
+    int device = -1;            //vector of the latest interrupt, which the next ISR body belongs to
+    unsigned int capacity = 0;  //Mb of memory in this run
+    std::vector<slot> table;    //by partition number - 1
+
+    void close(size_t index) {
+        slot& entry = table[index];
+        if(!entry.occupied) {
+            return;
+        }
+        partition_usage& usage = partitions[{static_cast<unsigned int>(index + 1), entry.size}];
+        usage.occupied_time += now - entry.since;
+        usage.wasted_time += uint64_t(entry.size - entry.used) * (now - entry.since);
+        entry.occupied = false;
+    }
+};
 
-    execution += std::to_string(current_time) + ", " + std::to_string(1) + ", load address " + vectors.at(intr_num) + " into the PC\n";
-    current_time++;
+void analytics_occupy(unsigned int partition_number, unsigned int size, unsigned int used) {
+    active_analytics->occupy(partition_number, size, used);
+}
 
-    return std::make_pair(execution, current_time);
+void analytics_release(unsigned int partition_number) {
+    active_analytics->release(partition_number);
 }
 
-//Writes a string to a file
-void write_output(std::string execution, const char* filename) {
-    std::ofstream output_file(filename);
+//Makes analytics the active analytics of this thread until the end of the scope
+class analytics_scope {
+public:
+    explicit analytics_scope(run_analytics* analytics) : previous(active_analytics) {
+        active_analytics = analytics;
+    }
+
+    ~analytics_scope() {
+        active_analytics = previous;
+    }
+
+private:
+    run_analytics* previous;
+};
+
+//Writes the --analytics summary
+void print_run_analytics(const run_analytics& analytics, std::ostream& out) {
+    auto percent = [](double part, double whole) {
+        return whole > 0 ? 100.0 * part / whole : 0.0;
+    };
+    std::ios::fmtflags flags = out.flags();
+    char fill = out.fill(' ');
+    out << std::fixed << std::setprecision(1);
+
+    out << "Analytics: " << analytics.runs << " run(s), " << analytics.elapsed << " ms simulated" << std::endl;
+    out << "  " << std::left << std::setw(28) << "CPU burst time" << std::right << std::setw(14) << analytics.cpu_time
+        << " ms " << std::setw(6) << percent(analytics.cpu_time, analytics.elapsed) << "%" << std::endl;
+    out << "  " << std::left << std::setw(28) << "kernel time" << std::right << std::setw(14) << analytics.kernel_time
+        << " ms " << std::setw(6) << percent(analytics.kernel_time, analytics.elapsed) << "%" << std::endl;
+    if(analytics.idle_time > 0) {
+        out << "  " << std::left << std::setw(28) << "idle time" << std::right << std::setw(14) << analytics.idle_time
+            << " ms " << std::setw(6) << percent(analytics.idle_time, analytics.elapsed) << "%" << std::endl;
+    }
+    out << "  " << std::left << std::setw(28) << "kernel / CPU burst time" << std::right << std::setw(14) << std::setprecision(3)
+        << (analytics.cpu_time > 0 ? static_cast<double>(analytics.kernel_time) / analytics.cpu_time : 0.0)
+        << std::setprecision(1) << std::endl;
+
+    out << "ISR time by device" << std::endl;
+    for(const auto& [device, time] : analytics.isr_time) {
+        out << "  device " << std::left << std::setw(21) << device << std::right << std::setw(14) << time << " ms" << std::endl;
+    }
 
-    if (output_file.is_open()) {
-        output_file << execution;
-        output_file.close();  // Close the file when done
-        std::cout << "File content overwritten successfully." << std::endl;
+    uint64_t occupied_mb_time = 0;
+    uint64_t wasted_mb_time = 0;
+    for(const auto& [key, usage] : analytics.partitions) {
+        occupied_mb_time += key.second * usage.occupied_time;
+        wasted_mb_time += usage.wasted_time;
+    }
+    out << "Memory (time-weighted)" << std::endl;
+    out << "  " << std::left << std::setw(28) << "utilisation" << std::right << std::setw(13)
+        << percent(occupied_mb_time, analytics.capacity_time) << "% of configured Mb" << std::endl;
+    out << "  " << std::left << std::setw(28) << "internal fragmentation" << std::right << std::setw(13)
+        << percent(wasted_mb_time, occupied_mb_time) << "% of occupied Mb" << std::endl;
+    //Dynamic allocators name a block by its address, so their table can get long
+    if(analytics.partitions.size() > 32) {
+        out << "  " << analytics.partitions.size() << " partitions or blocks (table omitted)" << std::endl;
     } else {
-        std::cerr << "Error opening file!" << std::endl;
+        out << "  partition      size  occupied  allocations  unused Mb (avg)" << std::endl;
+        for(const auto& [key, usage] : analytics.partitions) {
+            out << "  " << std::setw(9) << key.first << std::setw(10) << key.second
+                << std::setw(9) << percent(usage.occupied_time, analytics.elapsed) << "%"
+                << std::setw(13) << usage.allocations << std::setw(17)
+                << (usage.occupied_time > 0 ? static_cast<double>(usage.wasted_time) / usage.occupied_time : 0.0) << std::endl;
+        }
+    }
+
+    static const char* bucket_names[run_analytics::WASTE_BUCKETS] = {"0", "1", "2-3", "4-7", "8-15", "16-31", "32+"};
+    out << "Allocations" << std::endl;
+    out << "  " << std::left << std::setw(28) << "successful" << std::right << std::setw(14) << analytics.allocations << std::endl;
+    out << "  " << std::left << std::setw(28) << "failed (no partition)" << std::right << std::setw(14) << analytics.failures
+        << "    " << std::setw(6) << percent(analytics.failures, analytics.allocations + analytics.failures) << "%" << std::endl;
+    out << "  unused Mb per allocation:";
+    for(size_t k = 0; k < run_analytics::WASTE_BUCKETS; k++) {
+        out << "  " << bucket_names[k] << ": " << analytics.waste_histogram[k];
+    }
+    out << std::endl;
+
+    out.flags(flags);
+    out.fill(fill);
+}
+
+//Where simulation results end up: rendered text files or a binary log
+class event_writer {
+public:
+    virtual ~event_writer() = default;
+
+    virtual void write_events(const event* events, size_t count) = 0;
+
+    //PCB table after a FORK or EXEC: the running process, then first_waiting
+    //(when not null), then the wait queue
+    virtual void write_snapshot(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                                const PCB* first_waiting, const wait_queue& waiting) = 0;
+
+    virtual void flush() = 0;
+};
+
+/*
+    Fixed-capacity buffer the engine emits events into. When it fills up (and at
+    the end of the run) the events are handed to the writer in one batch.
+*/
+class event_buffer {
+public:
+    explicit event_buffer(event_writer& _writer, size_t capacity = 4096):
+        writer(&_writer), events(capacity), count(0) {}
+
+    //Sends the following events to another writer, keeping the buffer; pending events go to the old one
+    void attach(event_writer& _writer) {
+        write_pending();
+        writer = &_writer;
+    }
+
+    void emit(int time, int duration, event_kind kind, int operand = 0) {
+        if(count == events.size()) {
+            STATS_TIMER(OUTPUT);
+            write_pending();
+        }
+        events[count++] = event{time, duration, kind, operand};
+        emitted += event_lines(kind);
+        if(active_analytics != nullptr) {
+            active_analytics->record(events[count - 1]);
+        }
+        if(recording > 0 && !overflowed) {
+            if(tape.size() < tape_limit) {
+                tape.push_back(events[count - 1]);
+            } else {
+                drop_tape();
+            }
+        }
+    }
+
+    //Number of execution log lines emitted so far (snapshots not included)
+    size_t size() const {
+        return emitted;
+    }
+
+    //Pending events are written first so a combined log keeps them in order
+    void snapshot(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                  const PCB* first_waiting, const wait_queue& waiting) {
+        STATS_TIMER(OUTPUT);
+        STATS_COUNT(SNAPSHOT);
+        if(recording > 0 && !overflowed) {
+            tape_snapshots.push_back(recorded_snapshot{tape.size(), time, trace_type, duration, running_pcb,
+                                                       first_waiting ? std::optional<PCB>(*first_waiting) : std::nullopt,
+                                                       waiting});
+        }
+        write_pending();
+        writer->write_snapshot(time, trace_type, duration, running_pcb, first_waiting, waiting);
+    }
+
+    //A snapshot taken while recording; position is the number of taped events before it
+    struct recorded_snapshot {
+        size_t              position;
+        int                 time;
+        opcode              trace_type;
+        int                 duration;
+        PCB                 running_pcb;
+        std::optional<PCB>  first_waiting;
+        wait_queue          waiting;
+    };
+
+    /*
+        While at least one recording is open, every event and snapshot is also
+        kept on a tape, so a stretch of the run can be cached and replayed later
+        (see exec_memo). Recordings nest; the tape is emptied when the last one
+        is closed. The tape holds at most limit events (the smallest limit of the
+        open recordings); past that it is dropped and every open recording is
+        abandoned, see tape_overflowed().
+    */
+    void start_recording(size_t limit) {
+        tape_limit = recording++ == 0 ? limit : std::min(tape_limit, limit);
+    }
+
+    void stop_recording() {
+        if(--recording == 0) {
+            tape.clear();
+            tape_snapshots.clear();
+            overflowed = false;
+        }
+    }
+
+    //True once the tape has been dropped; the open recordings cannot be kept
+    bool tape_overflowed() const {
+        return overflowed;
+    }
+
+    const std::vector<event>& tape_events() const {
+        return tape;
+    }
+
+    const std::vector<recorded_snapshot>& tape_snapshot_list() const {
+        return tape_snapshots;
+    }
+
+    void flush() {
+        STATS_TIMER(OUTPUT);
+        write_pending();
+        writer->flush();
+    }
+
+    //Drops the pending events and closes every recording without writing anything, after a run failed part way
+    void discard() {
+        count = 0;
+        recording = 0;
+        tape_limit = 0;
+        overflowed = false;
+        tape.clear();
+        tape_snapshots.clear();
+    }
+
+private:
+    event_writer* writer;
+    std::vector<event> events;
+    size_t count;
+    size_t emitted = 0;
+
+    int recording = 0;
+    size_t tape_limit = 0;
+    bool overflowed = false;
+    std::vector<event> tape;
+    std::vector<recorded_snapshot> tape_snapshots;
+
+    void drop_tape() {
+        overflowed = true;
+        tape.clear();
+        tape_snapshots.clear();
+    }
+
+    void write_pending() {
+        if(count > 0) {
+            STATS_ADD(EVENT, count);
+            writer->write_events(events.data(), count);
+            count = 0;
+        }
     }
+};
+
+/*
+    Default interrupt boilerplate: switch to kernel mode, save the context, find
+    the vector and load the ISR address. It is emitted as a single PROLOGUE event
+    that the formatter expands from its per-vector template.
 
-    std::cout << "Output generated in execution.txt" << std::endl;
+    returns the time after the ISR address is loaded
+*/
+int intr_boilerplate(int current_time, int intr_num, int context_save_time, event_buffer& events) {
+    events.emit(current_time, context_save_time, event_kind::PROLOGUE, intr_num);
+    return current_time + context_save_time + 3;
 }
 
 //Helper function for a sanity check. Prints the external files table
-void print_external_files(std::vector<external_file> files) {
+void print_external_files(std::vector<external_file> files, std::ostream& out = std::cout) {
     const int tableWidth = 24;
 
-    std::cout << "List of external files (" << files.size() << " entry(s)): " << std::endl;
+    out << "List of external files (" << files.size() << " entry(s)): " << std::endl;
     
     // Print top border
-    std::cout << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
+    out << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
     
     // Print headers
-    std::cout << "|"
+    out << "|"
               << std::setfill(' ') << std::setw(10) << "file name"
               << std::setw(2) << "|"
               << std::setfill(' ') << std::setw(10) << "files size"
               << std::setw(2) << "|" << std::endl;
     
     // Print separator
-    std::cout << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
+    out << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
     
     // Print each PCB entry
     for (const auto& file : files) {
-        std::cout << "|"
-                  << std::setfill(' ') << std::setw(10) << file.program_name
+        out << "|"
+                  << std::setfill(' ') << std::setw(10) << symbol_name(file.program)
                   << std::setw(2) << "|"
                   << std::setw(10) << file.size
                   << std::setw(2) << "|" << std::endl;
     }
     
     // Print bottom border
-    std::cout << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
+    out << "+" << std::setfill('-') << std::setw(tableWidth) << "+" << std::endl;
 }
 
 //This function takes as input: the current PCB and the waitqueue (which is a
@@ -282,7 +2901,7 @@ std::string print_PCB(PCB current, std::vector<PCB> _PCB) {
     buffer << "|"
                   << std::setfill(' ') << std::setw(4) << current.PID
                   << std::setw(2) << "|"
-                  << std::setw(12) << current.program_name
+                  << std::setw(12) << symbol_name(current.program)
                   << std::setw(2) << "|"
                   << std::setw(16) << current.partition_number
                   << std::setw(2) << "|"
@@ -296,7 +2915,7 @@ std::string print_PCB(PCB current, std::vector<PCB> _PCB) {
         buffer << "|"
                   << std::setfill(' ') << std::setw(4) << program.PID
                   << std::setw(2) << "|"
-                  << std::setw(12) << program.program_name
+                  << std::setw(12) << symbol_name(program.program)
                   << std::setw(2) << "|"
                   << std::setw(16) << program.partition_number
                   << std::setw(2) << "|"
@@ -313,16 +2932,10 @@ std::string print_PCB(PCB current, std::vector<PCB> _PCB) {
 }
 
 
-// Searches the external_files table and returns the size of the program
-unsigned int get_size(std::string name, std::vector<external_file> external_files) {
-    int size = -1;
-
-    for (auto file : external_files) { 
-        if(file.program_name == name){
-            size = file.size;
-            break;
-        }
-    }
+// Looks the program up in the external_files registry and returns its size
+unsigned int get_size(const std::string& name, const program_registry& external_files) {
+    int id = external_files.find(name);
+    int size = id == -1 ? -1 : external_files[id].size;
 
     return size;
 }
@@ -331,13 +2944,10 @@ unsigned int get_size(std::string name, std::vector<external_file> external_file
 * Function to simulate CPU time 
 */
 
-std::string simulate_cpu(int duration, int& current_time) {
+void simulate_cpu(int duration, int& current_time, event_buffer& events) {
 
-    std::string result = std::to_string(current_time) + ", " 
-                        + std::to_string(duration) + ", "
-                        + "CPU Burst\n";
+    events.emit(current_time, duration, event_kind::CPU_BURST);
     current_time += duration;
-    return result;
 
 }
 
@@ -346,18 +2956,16 @@ std::string simulate_cpu(int duration, int& current_time) {
     device_num: the device number (index in the delays vector)
     current_time: reference to the current time in the simulation
     delays: vector of delays for each device
+    isr_type: the interrupt being serviced (opcode::SYSCALL or opcode::END_IO)
 
-    returns a string representing the ISR execution log
+    emits the ISR execution event
 */
 
-std::string execute_isr(int device_num, int& current_time, std::vector<int>& delays,
-                        const std::string& isr_type) {
+void execute_isr(int device_num, int& current_time, const std::vector<int>& delays,
+                 opcode isr_type, event_buffer& events) {
     int isr_delay = delays[device_num];
-    std::string result = std::to_string(current_time) + ", " 
-                        + std::to_string(isr_delay) + ", " 
-                        + isr_type + ": run the ISR\n";
+    events.emit(current_time, isr_delay, event_kind::RUN_ISR, static_cast<int>(isr_type));
     current_time += isr_delay;
-    return result;
 
 }
 
@@ -365,39 +2973,34 @@ std::string execute_isr(int device_num, int& current_time, std::vector<int>& del
     IRET execution function, simulates the execution of the IRET instruction
     current_time: reference to the current time in the simulation
 
-    returns a string representing the IRET execution log
+    emits the IRET event
 */
-std::string execute_iret(int& current_time) {
-    std::string result = std::to_string(current_time) + ", 1, IRET\n";
+void execute_iret(int& current_time, event_buffer& events) {
+    events.emit(current_time, 1, event_kind::IRET);
     current_time += 1;
-    return result;
 }
 
 /*
     restore_context function, simulates the restoration of the CPU context
     current_time: reference to the current time in the simulation
+    context_restore_time: how long the restore takes
 
-    returns a string representing the context restoration log
+    emits the context restoration event
 */
-std::string restore_context(int& current_time) {
-    const int CONTEXT_TIME = 10;
-    std::string result = std::to_string(current_time) + ", " 
-                        + std::to_string(CONTEXT_TIME) + ", " 
-                        + "context restored\n";
-    current_time += CONTEXT_TIME;
-    return result;
+void restore_context(int& current_time, int context_restore_time, event_buffer& events) {
+    events.emit(current_time, context_restore_time, event_kind::CONTEXT_RESTORED);
+    current_time += context_restore_time;
 }
 
 /*
     switch_to_user_mode function, simulates switching the CPU back to user mode
     current_time: reference to the current time in the simulation
 
-    returns a string representing the switch to user mode log
+    emits the switch to user mode event
 */
-std::string switch_to_user_mode(int& current_time) {
-    std::string result = std::to_string(current_time) + ", 1, switch to user mode\n";
+void switch_to_user_mode(int& current_time, event_buffer& events) {
+    events.emit(current_time, 1, event_kind::USER_MODE);
     current_time += 1;
-    return result;
 }
 
 
@@ -405,51 +3008,410 @@ std::string switch_to_user_mode(int& current_time) {
     handle_interrupt function, simulates the entire interrupt handling process
     device_num: the device number (index in the vectors and delays vectors)
     current_time: reference to the current time in the simulation
-    vectors: vector of ISR addresses for each device
     delays: vector of delays for each device
-    interrupt_type: string representing the type of interrupt (e.g., "SYSCALL", "END_IO")
+    interrupt_type: the type of interrupt (opcode::SYSCALL or opcode::END_IO)
+    timing: context save and restore times
 
-    returns a string representing the complete interrupt handling log
+    emits the complete interrupt handling sequence; IRET, the context restore and
+    the switch to user mode go out as one EPILOGUE event
 */
-std::string handle_interrupt(int device_num, int& current_time, std::vector<std::string>& vectors, std::vector<int>& delays, const std::string& interrupt_type) {
+void handle_interrupt(int device_num, int& current_time, const std::vector<int>& delays, opcode interrupt_type,
+                      const interrupt_timing& timing, event_buffer& events) {
 
-    std::string result = "";
-    const int CONTEXT_TIME = 10;
+    current_time = intr_boilerplate(current_time, device_num, timing.context_save, events);
 
-    auto [boilerplate, new_time] = intr_boilerplate(current_time, device_num, CONTEXT_TIME, vectors);
+    execute_isr(device_num, current_time, delays, interrupt_type, events);
 
-    result += boilerplate;
-    current_time = new_time;
+    events.emit(current_time, timing.context_restore, event_kind::EPILOGUE);
+    current_time += timing.context_restore + 2;
 
-    result += execute_isr(device_num, current_time, delays, interrupt_type);
-    result += execute_iret(current_time);
-    result += restore_context(current_time);
-    result += switch_to_user_mode(current_time);
-
-    return result;
+}
+// Writes one row of the system status table
+void append_pcb_row(output_sink& system_status, const PCB& pcb, const char* state) {
+    write_text(system_status, "|   ");
+    write_int(system_status, pcb.PID);
+    write_text(system_status, " |    ");
+    system_status.write(symbol_name(pcb.program));
+    write_text(system_status, " |               ");
+    write_int(system_status, pcb.partition_number);
+    write_text(system_status, " |    ");
+    write_int(system_status, pcb.size);
+    write_text(system_status, " | ");
+    write_text(system_status, state);
+    write_text(system_status, " |\n");
+}
 
+// Writes the title and the column headers of a system status table
+void append_status_header(output_sink& system_status, int current_time, const char* trace_type, int duration) {
+    write_text(system_status, "time: ");
+    write_int(system_status, current_time);
+    write_text(system_status, "; current trace: ");
+    write_text(system_status, trace_type);
+    write_text(system_status, ", ");
+    write_int(system_status, duration);
+    write_text(system_status, "\n");
+    write_text(system_status, "+------------------------------------------------------+\n");
+    write_text(system_status, "| PID |program name |partition number | size |   state |\n");
+    write_text(system_status, "+------------------------------------------------------+\n");
 }
-#endif
+
 // Helper function to append system status table
-void append_system_status(std::string& system_status, int current_time, const std::string& trace_type, 
-                         int duration, const PCB& running_pcb, const std::vector<PCB>& waiting_pcbs) {
-    system_status += "time: " + std::to_string(current_time) + "; current trace: " + trace_type + ", " 
-                    + std::to_string(duration) + "\n";
-    system_status += "+------------------------------------------------------+\n";
-    system_status += "| PID |program name |partition number | size |   state |\n";
-    system_status += "+------------------------------------------------------+\n";
+void append_system_status(output_sink& system_status, int current_time, const char* trace_type, 
+                         int duration, const PCB& running_pcb, const PCB* first_waiting, const wait_queue& waiting) {
+    append_status_header(system_status, current_time, trace_type, duration);
     
     // Show running process
-    system_status += "|   " + std::to_string(running_pcb.PID) + " |    " + running_pcb.program_name 
-            + " |               " + std::to_string(running_pcb.partition_number) + " |    " 
-            + std::to_string(running_pcb.size) + " | running |\n";
+    append_pcb_row(system_status, running_pcb, "running");
     
-    // Show all waiting processes
-    for (const auto& pcb : waiting_pcbs) {
-        system_status += "|   " + std::to_string(pcb.PID) + " |    " + pcb.program_name 
-                + " |               " + std::to_string(pcb.partition_number) + " |    " 
-                + std::to_string(pcb.size) + " | waiting |\n";
+    // Show all waiting processes, straight from the shared queue
+    if (first_waiting != nullptr) {
+        append_pcb_row(system_status, *first_waiting, "waiting");
     }
+    waiting.for_each([&](const PCB& pcb) {
+        append_pcb_row(system_status, pcb, "waiting");
+    });
     
-    system_status += "+------------------------------------------------------+\n\n";
-}
\ No newline at end of file
+    write_text(system_status, "+------------------------------------------------------+\n\n");
+}
+
+//One row of a system status table
+struct status_row {
+    PCB     pcb;
+    bool    waiting;
+};
+
+/*
+    The system status snapshots of a run, kept as deltas. Each snapshot only
+    records how its table differs from the previous one (rows added, removed,
+    moved, or with a new state, partition or program), and every
+    keyframe_interval-th snapshot is stored in full so any snapshot can be
+    rebuilt from the keyframe before it. Tables are rendered only on request:
+    all of them (the usual system_status file) or the one in effect at a time.
+*/
+class status_history {
+public:
+    explicit status_history(size_t _keyframe_interval = 64) : keyframe_interval(std::max<size_t>(1, _keyframe_interval)) {}
+
+    //Records a snapshot with the same rows append_system_status would write
+    void record(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                const PCB* first_waiting, const wait_queue& waiting) {
+        next.clear();
+        next.push_back(status_row{running_pcb, false});
+        if(first_waiting != nullptr) {
+            next.push_back(status_row{*first_waiting, true});
+        }
+        waiting.for_each([&](const PCB& pcb) {
+            next.push_back(status_row{pcb, true});
+        });
+
+        //A delta that loses to a keyframe is rolled back, rows included
+        snapshot entry{time, trace_type, duration, false, ops.size(), 0};
+        size_t rows_before = rows.size();
+        if(snapshots.size() % keyframe_interval == 0 || !encode_delta(entry)) {
+            ops.resize(entry.first);
+            rows.erase(rows.begin() + rows_before, rows.end());
+            entry.keyframe = true;
+            entry.first = rows.size();
+            entry.count = next.size();
+            rows.insert(rows.end(), next.begin(), next.end());
+        }
+        snapshots.push_back(entry);
+        std::swap(current, next);
+    }
+
+    size_t size() const {
+        return snapshots.size();
+    }
+
+    //Drops every snapshot but keeps the memory for the next run
+    void clear() {
+        snapshots.clear();
+        ops.clear();
+        rows.clear();
+        current.clear();
+    }
+
+    //Index of the last snapshot taken at or before time, -1 if there is none
+    long find(int time) const {
+        auto it = std::upper_bound(snapshots.begin(), snapshots.end(), time,
+                                   [](int t, const snapshot& entry) { return t < entry.time; });
+        return static_cast<long>(it - snapshots.begin()) - 1;
+    }
+
+    //Rebuilds the table of one snapshot from the keyframe before it
+    void materialize(size_t index, std::vector<status_row>& table) const {
+        size_t start = index;
+        while(!snapshots[start].keyframe) {
+            start--;
+        }
+        table.clear();
+        for(size_t k = start; k <= index; k++) {
+            apply(snapshots[k], table);
+        }
+    }
+
+    //Renders every snapshot, in order, exactly as append_system_status does
+    void render_all(output_sink& system_status) const {
+        std::vector<status_row> table;
+        for(const auto& entry : snapshots) {
+            apply(entry, table);
+            render(entry, table, system_status);
+        }
+    }
+
+    //Renders the snapshot in effect at time; returns false if there is none yet
+    bool render_at(int time, output_sink& system_status) const {
+        long index = find(time);
+        if(index < 0) {
+            return false;
+        }
+        std::vector<status_row> table;
+        materialize(index, table);
+        render(snapshots[index], table, system_status);
+        return true;
+    }
+
+private:
+    enum class op_kind : uint8_t {
+        REMOVE,     //pid leaves the table
+        STATE,      //value: 1 waiting, 0 running
+        PARTITION,  //value: partition number
+        REPLACE,    //row: the PCB changed in more than state and partition (EXEC)
+        ADD,        //row inserted at position
+        MOVE        //existing row moved to position
+    };
+
+    struct delta_op {
+        op_kind         kind;
+        unsigned int    pid;
+        int             value;
+        size_t          position;
+        size_t          row;        //index into rows for ADD and REPLACE
+    };
+
+    struct snapshot {
+        int     time;
+        opcode  trace_type;
+        int     duration;
+        bool    keyframe;
+        size_t  first;      //first row (keyframe) or op (delta)
+        size_t  count;
+    };
+
+    size_t keyframe_interval;
+    std::vector<snapshot> snapshots;
+    std::vector<delta_op> ops;
+    std::vector<status_row> rows;           //keyframe tables and rows carried by ops
+    std::vector<status_row> current;        //table of the last recorded snapshot
+    std::vector<status_row> next;
+    std::unordered_map<unsigned int, size_t> previous_index;
+    std::vector<size_t> order, tails, parent;
+    std::vector<bool> kept, stays;
+
+    //Scratch for apply(), reused so rendering does not allocate per snapshot; rendering is therefore not thread safe
+    mutable std::vector<size_t> row_of;         //by PID: row in the table (or in moving, once set aside)
+    mutable std::vector<bool> taken;            //rows removed or moved by the delta being applied
+    mutable std::vector<status_row> moving;
+    mutable std::vector<status_row> rebuilt;
+
+    static bool same_program(const PCB& a, const PCB& b) {
+        return a.PPID == b.PPID && a.size == b.size && a.program == b.program;
+    }
+
+    /*
+        Appends the ops that turn current into next. Rows that keep their relative
+        order (the longest increasing run of their old positions) stay put and the
+        others are moved. Returns false when a keyframe is the better choice:
+        duplicate PIDs or a delta with more ops than rows.
+    */
+    bool encode_delta(snapshot& entry) {
+        previous_index.clear();
+        for(size_t k = 0; k < current.size(); k++) {
+            if(!previous_index.emplace(current[k].pcb.PID, k).second) {
+                return false;
+            }
+        }
+
+        kept.assign(current.size(), false);
+        order.clear();
+        for(size_t k = 0; k < next.size(); k++) {
+            auto it = previous_index.find(next[k].pcb.PID);
+            if(it == previous_index.end()) {
+                order.push_back(SIZE_MAX);
+                continue;
+            }
+            if(kept[it->second]) {
+                return false;
+            }
+            kept[it->second] = true;
+            order.push_back(it->second);
+
+            const status_row& before = current[it->second];
+            const status_row& after = next[k];
+            if(!same_program(before.pcb, after.pcb)) {
+                ops.push_back(delta_op{op_kind::REPLACE, after.pcb.PID, 0, 0, rows.size()});
+                rows.push_back(after);
+                continue;
+            }
+            if(before.waiting != after.waiting) {
+                ops.push_back(delta_op{op_kind::STATE, after.pcb.PID, after.waiting, 0, 0});
+            }
+            if(before.pcb.partition_number != after.pcb.partition_number) {
+                ops.push_back(delta_op{op_kind::PARTITION, after.pcb.PID, after.pcb.partition_number, 0, 0});
+            }
+        }
+        for(size_t k = 0; k < current.size(); k++) {
+            if(!kept[k]) {
+                ops.push_back(delta_op{op_kind::REMOVE, current[k].pcb.PID, 0, 0, 0});
+            }
+        }
+
+        //Longest increasing subsequence of old positions: those rows do not move
+        tails.clear();
+        parent.assign(order.size(), SIZE_MAX);
+        for(size_t k = 0; k < order.size(); k++) {
+            if(order[k] == SIZE_MAX) {
+                continue;
+            }
+            size_t low = 0, high = tails.size();
+            while(low < high) {
+                size_t middle = (low + high) / 2;
+                if(order[tails[middle]] < order[k]) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            parent[k] = low > 0 ? tails[low - 1] : SIZE_MAX;
+            if(low == tails.size()) {
+                tails.push_back(k);
+            } else {
+                tails[low] = k;
+            }
+        }
+        stays.assign(order.size(), false);
+        for(size_t k = tails.empty() ? SIZE_MAX : tails.back(); k != SIZE_MAX; k = parent[k]) {
+            stays[k] = true;
+        }
+
+        for(size_t k = 0; k < next.size(); k++) {
+            if(order[k] == SIZE_MAX) {
+                ops.push_back(delta_op{op_kind::ADD, next[k].pcb.PID, 0, k, rows.size()});
+                rows.push_back(next[k]);
+            } else if(!stays[k]) {
+                ops.push_back(delta_op{op_kind::MOVE, next[k].pcb.PID, 0, k, 0});
+            }
+        }
+
+        entry.count = ops.size() - entry.first;
+        return entry.count <= next.size();
+    }
+
+    //Turns the previous snapshot's table into this one's
+    void apply(const snapshot& entry, std::vector<status_row>& table) const {
+        if(entry.keyframe) {
+            table.assign(rows.begin() + entry.first, rows.begin() + entry.first + entry.count);
+            return;
+        }
+
+        const delta_op* begin = ops.data() + entry.first;
+        const delta_op* end = begin + entry.count;
+
+        //Rows are found by PID; entries of PIDs no longer in the table go stale but are never asked for
+        for(size_t k = 0; k < table.size(); k++) {
+            unsigned int pid = table[k].pcb.PID;
+            if(pid >= row_of.size()) {
+                row_of.resize(pid + 1, SIZE_MAX);
+            }
+            row_of[pid] = k;
+        }
+
+        //Changes in place, and mark the rows that are removed or moved
+        taken.assign(table.size(), false);
+        bool reorder = false;
+        for(const delta_op* op = begin; op != end; op++) {
+            if(op->kind == op_kind::STATE) {
+                table[row_of[op->pid]].waiting = op->value != 0;
+            } else if(op->kind == op_kind::PARTITION) {
+                table[row_of[op->pid]].pcb.partition_number = op->value;
+            } else if(op->kind == op_kind::REPLACE) {
+                table[row_of[op->pid]] = rows[op->row];
+            } else {
+                if(op->kind != op_kind::ADD) {
+                    taken[row_of[op->pid]] = true;
+                }
+                reorder = true;
+            }
+        }
+        if(!reorder) {
+            return;
+        }
+
+        //Taken rows are set aside (row_of now points into moving for them)
+        moving.clear();
+        for(size_t k = 0; k < table.size(); k++) {
+            if(taken[k]) {
+                row_of[table[k].pcb.PID] = moving.size();
+                moving.push_back(std::move(table[k]));
+            }
+        }
+
+        //ADD and MOVE come in position order, so the new table is the rows that stay with them merged in
+        rebuilt.clear();
+        size_t cursor = 0;
+        auto keep_until = [&](size_t position) {
+            for(; rebuilt.size() < position && cursor < table.size(); cursor++) {
+                if(!taken[cursor]) {
+                    rebuilt.push_back(std::move(table[cursor]));
+                }
+            }
+        };
+        for(const delta_op* op = begin; op != end; op++) {
+            if(op->kind == op_kind::ADD) {
+                keep_until(op->position);
+                rebuilt.push_back(rows[op->row]);
+            } else if(op->kind == op_kind::MOVE) {
+                keep_until(op->position);
+                rebuilt.push_back(std::move(moving[row_of[op->pid]]));
+            }
+        }
+        keep_until(SIZE_MAX);
+        table.swap(rebuilt);
+    }
+
+    static void render(const snapshot& entry, const std::vector<status_row>& table, output_sink& system_status) {
+        append_status_header(system_status, entry.time, opcode_name(entry.trace_type), entry.duration);
+        for(const auto& row : table) {
+            append_pcb_row(system_status, row.pcb, row.waiting ? "waiting" : "running");
+        }
+        write_text(system_status, "+------------------------------------------------------+\n\n");
+    }
+};
+
+//Writes execution.txt style text; snapshots are kept in a status_history and rendered later
+class text_event_writer : public event_writer {
+public:
+    text_event_writer(const event_formatter& _formatter, output_sink& _execution, status_history& _history):
+        formatter(_formatter), execution(_execution), history(_history) {}
+
+    void write_events(const event* events, size_t count) override {
+        for(size_t k = 0; k < count; k++) {
+            formatter.render(events[k], execution);
+        }
+    }
+
+    void write_snapshot(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                        const PCB* first_waiting, const wait_queue& waiting) override {
+        history.record(time, trace_type, duration, running_pcb, first_waiting, waiting);
+    }
+
+    void flush() override {
+        execution.flush();
+    }
+
+private:
+    const event_formatter& formatter;
+    output_sink& execution;
+    status_history& history;
+};
+#endif
@@ -0,0 +1,928 @@
+/**
+ *
+ * @file benchmark.cpp
+ * @brief Runs generated workloads through the Simulator and records throughput, memory and allocations,
+ *        compares the partition placement policies (--policies) or checks the status tables (--verify)
+ *
+ */
+
+#include "simulator.hpp"
+#include "smp.hpp"
+#include "workload.hpp"
+#include <cstdlib>
+#include <new>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+//Every call to the global operator new is counted. GCC cannot tell that the
+//replaced operators pair new with free, so its mismatch warning is turned off.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static std::atomic<size_t> allocation_count{0};
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if(void* block = std::malloc(size == 0 ? 1 : size)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    operator delete(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+struct scenario_spec {
+    std::string     name;
+    unsigned int    scale;
+};
+
+struct scenario_result {
+    std::string     name;
+    unsigned int    scale;
+    size_t          lines;              //trace plus program images
+    size_t          events;             //per run
+    size_t          output_bytes;       //execution and status text per run
+    int             end_time;
+    size_t          runs;
+    double          seconds_per_run;
+    double          events_per_second;
+    double          ns_per_line;
+    double          allocations_per_run;
+    long            peak_rss_kb;        //peak resident set size while this scenario ran, -1 if it cannot be measured
+};
+
+//How each placement policy did on one scenario (one run, with analytics)
+struct policy_result {
+    std::string         scenario;
+    unsigned int        scale;
+    placement_policy    policy;
+    uint64_t            allocations;
+    uint64_t            failures;       //FORKs and EXECs that found no partition
+    double              admission;      //allocations / (allocations + failures)
+    int                 end_time;
+};
+
+//How each placement policy did on the allocator churn stream
+struct churn_result {
+    placement_policy    policy;
+    size_t              ops;            //per pass
+    size_t              passes;
+    double              ns_per_op;
+    double              admission;      //requests placed / requests
+};
+
+const placement_policy all_policies[] = {placement_policy::BEST_FIT, placement_policy::FIRST_FIT,
+                                         placement_policy::WORST_FIT, placement_policy::NEXT_FIT};
+
+//Default sizes: each takes a fraction of a second per run with -O2
+std::vector<scenario_spec> default_scenarios(bool quick) {
+    if(quick) {
+        return {{"cpu_stream", 20000}, {"fork_wide", 2000}, {"fork_deep", 8}, {"exec_chain", 500}, {"partition_exhaustion", 2000}};
+    }
+    return {{"cpu_stream", 200000}, {"fork_wide", 20000}, {"fork_deep", 12}, {"exec_chain", 5000}, {"partition_exhaustion", 20000}};
+}
+
+/*
+    Per-scenario peak memory. Writing 5 to /proc/self/clear_refs (Linux) sets
+    the process's high-water mark back to what is resident now, so VmHWM read
+    after a scenario is that scenario's own peak rather than the largest one
+    seen so far. Elsewhere the peak cannot be reset and it is not reported.
+*/
+bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    return static_cast<bool>(clear_refs << "5" << std::flush);
+}
+
+long peak_rss_kb_since_reset() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return -1;
+}
+
+//Generates the workload in a scratch directory and calls body(w) from inside it; the directory is removed afterwards
+template<typename Body>
+void in_workload(const scenario_spec& spec, Body body) {
+    workload w;
+    if(!make_workload(spec.name, spec.scale, w)) {
+        throw simulator_error("unknown scenario " + spec.name);
+    }
+
+    std::filesystem::path previous = std::filesystem::current_path();
+    std::filesystem::path dir = std::filesystem::temp_directory_path()
+        / ("simulator_benchmark_" + spec.name + "_" + std::to_string(spec.scale) + "_" + std::to_string(getpid()));
+    write_workload(w, dir);
+    std::filesystem::current_path(dir);
+
+    try {
+        body(w);
+    } catch(...) {
+        std::filesystem::current_path(previous);
+        std::filesystem::remove_all(dir);
+        throw;
+    }
+
+    std::filesystem::current_path(previous);
+    std::filesystem::remove_all(dir);
+}
+
+/*
+    Loads the workload once and runs it until min_seconds have passed (at
+    least min_runs times). The trace is compiled and simulated on every run;
+    output is kept in memory so the numbers do not depend on the disk.
+*/
+scenario_result run_scenario(const scenario_spec& spec, double min_seconds, size_t min_runs) {
+    scenario_result result{spec.name, spec.scale, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    in_workload(spec, [&](const workload& w) {
+        bool measure_rss = reset_peak_rss();
+        result.lines = workload_lines(w);
+        Simulator simulator;
+        simulator.load_config("vector_table.txt", "device_table.txt", "external_files.txt");
+        simulator.load_partitions("partitions.txt");
+
+        //Warm-up run, also used for the per-run sizes
+        Simulator::run_result warm_up = simulator.run_lines(w.trace);
+        result.events = warm_up.events;
+        result.output_bytes = warm_up.execution_bytes + warm_up.status_bytes;
+        result.end_time = warm_up.end_time;
+
+        size_t allocations_before = allocation_count.load();
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while(result.runs < min_runs || elapsed < min_seconds) {
+            simulator.reset();
+            simulator.run_lines(w.trace);
+            result.runs++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        result.seconds_per_run = elapsed / result.runs;
+        result.events_per_second = result.events / result.seconds_per_run;
+        result.ns_per_line = result.seconds_per_run * 1e9 / result.lines;
+        result.allocations_per_run = static_cast<double>(allocation_count.load() - allocations_before) / result.runs;
+        result.peak_rss_kb = measure_rss ? peak_rss_kb_since_reset() : -1;
+    });
+    return result;
+}
+
+//Runs the workload once per placement policy, on the same partition table, and counts what each one admitted
+std::vector<policy_result> compare_policies(const scenario_spec& spec) {
+    std::vector<policy_result> results;
+    in_workload(spec, [&](const workload& w) {
+        Simulator simulator;
+        simulator.load_config("vector_table.txt", "device_table.txt", "external_files.txt");
+        simulator.load_partitions("partitions.txt");
+        simulator.collect_analytics(true);
+        for(placement_policy policy : all_policies) {
+            simulator.set_placement(policy);
+            simulator.reset();
+            Simulator::run_result run = simulator.run_lines(w.trace);
+
+            const run_analytics& analytics = simulator.analytics();
+            uint64_t requests = analytics.allocations + analytics.failures;
+            results.push_back(policy_result{spec.name, spec.scale, policy, analytics.allocations, analytics.failures,
+                                            requests == 0 ? 1.0 : static_cast<double>(analytics.allocations) / requests,
+                                            run.end_time});
+        }
+    });
+    return results;
+}
+
+/*
+    A seeded stream of allocator requests for the churn benchmark. A request
+    asks for size Mb; a release frees whatever request `value` was given, if it
+    was given anything. Every live request is released by the end, so a pass
+    leaves the table empty. The stream does not depend on the policy, so every
+    policy sees exactly the same requests.
+*/
+struct churn_op {
+    bool            release;
+    unsigned int    value;      //Mb requested, or the request to release
+};
+
+struct churn_stream {
+    std::vector<unsigned int>   layout;
+    std::vector<churn_op>       ops;
+    size_t                      requests = 0;
+};
+
+churn_stream make_churn_stream(size_t partitions, size_t ops, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    churn_stream stream;
+    for(size_t k = 0; k < partitions; k++) {
+        stream.layout.push_back(1 + rng() % 64);
+    }
+
+    //Keeps about three quarters of the partitions' worth of requests live
+    std::vector<unsigned int> live;
+    while(stream.ops.size() < ops) {
+        if(live.empty() || (live.size() < partitions * 3 / 4 && rng() % 2 == 0)) {
+            live.push_back(stream.requests++);
+            stream.ops.push_back(churn_op{false, 1 + static_cast<unsigned int>(rng() % 48)});
+        } else {
+            size_t pick = rng() % live.size();
+            stream.ops.push_back(churn_op{true, live[pick]});
+            live[pick] = live.back();
+            live.pop_back();
+        }
+    }
+    for(unsigned int request : live) {
+        stream.ops.push_back(churn_op{true, request});
+    }
+    return stream;
+}
+
+/*
+    Plays the churn stream against a fixed table placed by Policy, until
+    min_seconds have passed (at least 3 passes). The table is the template
+    itself rather than partition_manager, so each policy's search is inlined
+    into this loop.
+*/
+template<typename Policy>
+churn_result run_churn(placement_policy policy, const churn_stream& stream, double min_seconds) {
+    placed_partitions<Policy> table(stream.layout);
+    std::vector<int> given(stream.requests, -1);
+    churn_result result{policy, stream.ops.size(), 0, 0, 0};
+
+    size_t placed = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while(result.passes < 3 || elapsed < min_seconds) {
+        unsigned int request = 0;
+        placed = 0;
+        table.rewind();
+        for(const churn_op& op : stream.ops) {
+            if(op.release) {
+                table.release(given[op.value]);
+                continue;
+            }
+            int partition_number = table.place(op.value);
+            if(partition_number != -1) {
+                table.occupy(partition_number, request, op.value);
+                placed++;
+            }
+            given[request++] = partition_number;
+        }
+        result.passes++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    result.ns_per_op = elapsed * 1e9 / (static_cast<double>(result.ops) * result.passes);
+    result.admission = stream.requests == 0 ? 1.0 : static_cast<double>(placed) / stream.requests;
+    return result;
+}
+
+churn_result run_churn(placement_policy policy, const churn_stream& stream, double min_seconds) {
+    switch(policy) {
+        case placement_policy::FIRST_FIT: return run_churn<first_fit_policy>(policy, stream, min_seconds);
+        case placement_policy::WORST_FIT: return run_churn<worst_fit_policy>(policy, stream, min_seconds);
+        case placement_policy::NEXT_FIT:  return run_churn<next_fit_policy>(policy, stream, min_seconds);
+        default:                          return run_churn<best_fit_policy>(policy, stream, min_seconds);
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<scenario_result>& results) {
+    out << "{\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"scenarios\": [\n";
+    for(size_t k = 0; k < results.size(); k++) {
+        const scenario_result& r = results[k];
+        out << "    {\"name\": \"" << r.name << "\", \"scale\": " << r.scale
+            << ", \"lines\": " << r.lines << ", \"events\": " << r.events
+            << ", \"output_bytes\": " << r.output_bytes << ", \"end_time\": " << r.end_time
+            << ", \"runs\": " << r.runs << std::fixed << std::setprecision(6)
+            << ", \"seconds_per_run\": " << r.seconds_per_run << std::setprecision(1)
+            << ", \"events_per_second\": " << r.events_per_second
+            << ", \"ns_per_line\": " << r.ns_per_line
+            << ", \"allocations_per_run\": " << r.allocations_per_run
+            << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}"
+            << (k + 1 < results.size() ? "," : "") << "\n";
+        out.unsetf(std::ios::floatfield);
+    }
+    out << "  ]\n}\n";
+}
+
+void write_policies_json(std::ostream& out, const std::vector<policy_result>& results, const churn_stream& stream,
+                         const std::vector<churn_result>& churn) {
+    out << "{\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"policies\": [\n";
+    for(size_t k = 0; k < results.size(); k++) {
+        const policy_result& r = results[k];
+        out << "    {\"scenario\": \"" << r.scenario << "\", \"scale\": " << r.scale
+            << ", \"policy\": \"" << placement_name(r.policy) << "\""
+            << ", \"allocations\": " << r.allocations << ", \"failures\": " << r.failures
+            << std::fixed << std::setprecision(6) << ", \"admission\": " << r.admission
+            << ", \"end_time\": " << r.end_time << "}"
+            << (k + 1 < results.size() ? "," : "") << "\n";
+        out.unsetf(std::ios::floatfield);
+    }
+    out << "  ],\n";
+    out << "  \"allocator\": {\"partitions\": " << stream.layout.size() << ", \"ops\": " << stream.ops.size()
+        << ", \"requests\": " << stream.requests << ", \"results\": [\n";
+    for(size_t k = 0; k < churn.size(); k++) {
+        const churn_result& r = churn[k];
+        out << "    {\"policy\": \"" << placement_name(r.policy) << "\", \"passes\": " << r.passes
+            << std::fixed << std::setprecision(2) << ", \"ns_per_op\": " << r.ns_per_op
+            << std::setprecision(6) << ", \"admission\": " << r.admission << "}"
+            << (k + 1 < churn.size() ? "," : "") << "\n";
+        out.unsetf(std::ios::floatfield);
+    }
+    out << "  ]}\n}\n";
+}
+
+//Writes the results to output_path ("-" for stdout)
+template<typename Write>
+int write_results(const std::string& output_path, Write write) {
+    if(output_path == "-") {
+        write(std::cout);
+        return 0;
+    }
+    std::ofstream output_file(output_path);
+    if(!output_file.is_open()) {
+        std::cerr << "Error: Unable to open output file: " << output_path << std::endl;
+        return 1;
+    }
+    write(output_file);
+    std::cerr << "Results written to " << output_path << std::endl;
+    return 0;
+}
+
+/*
+    --policies: every scenario once per placement policy for admission, then
+    the churn stream on a large table for admission and ns per allocator op.
+*/
+int compare_all_policies(const std::vector<scenario_spec>& specs, bool quick, double min_seconds, const std::string& output_path) {
+    std::vector<policy_result> results;
+    std::vector<churn_result> churn;
+    churn_stream stream = make_churn_stream(256, quick ? 100000 : 1000000);
+    try {
+        for(const auto& spec : specs) {
+            for(const policy_result& r : compare_policies(spec)) {
+                std::cerr << std::left << std::setw(22) << r.scenario << std::right << std::setw(8) << r.scale
+                          << std::setw(7) << placement_name(r.policy) << std::setw(10) << r.allocations << " placed"
+                          << std::setw(8) << r.failures << " failed" << std::fixed << std::setprecision(2)
+                          << std::setw(9) << 100 * r.admission << "% admitted" << std::endl;
+                std::cerr.unsetf(std::ios::floatfield);
+                results.push_back(r);
+            }
+        }
+        for(placement_policy policy : all_policies) {
+            churn_result r = run_churn(policy, stream, min_seconds);
+            std::cerr << std::left << std::setw(22) << "allocator_churn" << std::right << std::setw(8) << stream.layout.size()
+                      << std::setw(7) << placement_name(r.policy) << std::fixed << std::setprecision(1)
+                      << std::setw(10) << r.ns_per_op << " ns/op" << std::setprecision(2)
+                      << std::setw(24) << 100 * r.admission << "% admitted" << std::endl;
+            std::cerr.unsetf(std::ios::floatfield);
+            churn.push_back(r);
+        }
+    } catch(const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    return write_results(output_path, [&](std::ostream& out) { write_policies_json(out, results, stream, churn); });
+}
+
+/*
+    Sends every snapshot to status_histories with several keyframe intervals
+    and, as the reference, straight to append_system_status, so --verify can
+    compare what the histories render with what was recorded.
+*/
+class snapshot_tee : public event_writer {
+public:
+    std::vector<status_history> histories;
+    string_sink                 expected;
+    std::vector<int>            times;
+    std::vector<size_t>         ends;       //end of each snapshot's table in expected
+
+    snapshot_tee() {
+        for(size_t interval : {size_t(1), size_t(3), size_t(64), size_t(1) << 30}) {
+            histories.emplace_back(interval);
+        }
+    }
+
+    void write_events(const event*, size_t) override {}
+
+    void write_snapshot(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                        const PCB* first_waiting, const wait_queue& waiting) override {
+        for(auto& history : histories) {
+            history.record(time, trace_type, duration, running_pcb, first_waiting, waiting);
+        }
+        append_system_status(expected, time, opcode_name(trace_type), duration, running_pcb, first_waiting, waiting);
+        times.push_back(time);
+        ends.push_back(expected.bytes_written());
+    }
+
+    void flush() override {}
+
+    //Checks render_all, and render_at for the last snapshot of each time, of every history; returns the mismatches
+    size_t check(const std::string& name) {
+        const std::string& reference = expected.str();
+        size_t mismatches = 0;
+        for(const auto& history : histories) {
+            string_sink all;
+            history.render_all(all);
+            if(all.str() != reference) {
+                std::cerr << "  " << name << ": render_all differs from append_system_status" << std::endl;
+                mismatches++;
+            }
+            for(size_t k = 0; k < times.size(); k++) {
+                if(k + 1 < times.size() && times[k + 1] == times[k]) {
+                    continue;
+                }
+                string_sink one;
+                history.render_at(times[k], one);
+                size_t begin = k == 0 ? 0 : ends[k - 1];
+                if(one.str() != reference.substr(begin, ends[k] - begin) && mismatches++ < 3) {
+                    std::cerr << "  " << name << ": render_at(" << times[k] << ") differs from append_system_status" << std::endl;
+                }
+            }
+        }
+        std::cerr << std::left << std::setw(22) << name << std::right << std::setw(8) << times.size() << " snapshots"
+                  << std::setw(8) << mismatches << " mismatched" << std::endl;
+        return mismatches;
+    }
+};
+
+/*
+    A seeded stream of tables that takes every path of the delta encoder:
+    processes that start and exit (ADD, REMOVE), change state or partition,
+    EXEC another program (REPLACE) and change places (MOVE), plus the odd
+    duplicate PID, which forces a keyframe.
+*/
+void feed_random_snapshots(snapshot_tee& tee, size_t count, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    const symbol programs[] = {intern("init"), intern("program1"), intern("program2"), intern("program3")};
+    std::vector<PCB> table = {PCB(0, -1, programs[0], 1, 6)};
+    unsigned int next_pid = 1;
+    int time = 0;
+
+    for(size_t step = 0; step < count; step++) {
+        size_t changes = 1 + rng() % 3;
+        for(size_t k = 0; k < changes; k++) {
+            size_t at = rng() % table.size();
+            switch(rng() % 6) {
+                case 0:
+                case 1:
+                    if(table.size() >= 16) {
+                        table.erase(table.begin() + at);
+                        break;
+                    }
+                    table.insert(table.begin() + rng() % (table.size() + 1),
+                                 PCB(next_pid++, table[at].PID, table[at].program, table[at].size, 1 + rng() % 6));
+                    break;
+                case 2:
+                    if(table.size() > 1) {
+                        table.erase(table.begin() + at);
+                    }
+                    break;
+                case 3:
+                    std::swap(table[at], table[rng() % table.size()]);
+                    break;
+                case 4:
+                    table[at].partition_number = 1 + rng() % 6;
+                    break;
+                default:
+                    table[at] = PCB(table[at].PID, table[at].PPID, programs[rng() % 4], 1 + rng() % 40, table[at].partition_number);
+                    break;
+            }
+        }
+
+        wait_queue waiting;
+        bool first = table.size() > 1 && rng() % 2 == 0;
+        for(size_t k = first ? 2 : 1; k < table.size(); k++) {
+            waiting = waiting.push(table[k]);
+        }
+        if(rng() % 50 == 0) {
+            waiting = waiting.push(table[0]);
+        }
+        time += rng() % 3;
+        tee.write_snapshot(time, rng() % 2 ? opcode::FORK : opcode::EXEC, 1 + rng() % 20, table[0],
+                           first ? &table[1] : nullptr, waiting);
+    }
+}
+
+//Runs the workload on the classic engine and checks its snapshots as status_history renders them; returns the mismatches
+size_t verify_status_history(const scenario_spec& spec) {
+    size_t mismatches = 0;
+    in_workload(spec, [&](const workload& w) {
+        Simulator simulator;
+        simulator.load_config("vector_table.txt", "device_table.txt", "external_files.txt");
+        const simulation_context& context = simulator.context();
+        compiled_trace trace = compile_trace(w.trace, context.external_files, context.tables());
+        partition_manager memory(load_partition_layout("partitions.txt"));
+
+        snapshot_tee tee;
+        event_buffer events(tee);
+        PCB init(0, -1, intern("init"), 1, -1);
+        if(!allocate_memory(&init, memory)) {
+            throw simulator_error("Memory allocation failed for init");
+        }
+        simulate_trace(context, trace, 0, init, wait_queue(), memory, events);
+        events.flush();
+        mismatches = tee.check(spec.name);
+    });
+    return mismatches;
+}
+
+//Keeps a core's events instead of writing them, so --verify can read the log back
+class event_recorder : public event_writer {
+public:
+    std::vector<event> events;
+
+    void write_events(const event* batch, size_t count) override {
+        events.insert(events.end(), batch, batch + count);
+    }
+
+    void write_snapshot(int, opcode, int, const PCB&, const PCB*, const wait_queue&) override {}
+
+    void flush() override {}
+};
+
+//One row of a written SMP status table
+struct smp_status_row {
+    size_t          core;
+    unsigned int    pid;
+    unsigned int    size;
+    std::string     state;
+};
+
+struct smp_status_table {
+    int                         time;
+    std::vector<smp_status_row> rows;
+};
+
+//Reads the tables back out of SMP system_status text
+std::vector<smp_status_table> parse_smp_status(const std::string& text) {
+    std::vector<smp_status_table> tables;
+    std::istringstream lines(text);
+    std::string line;
+    while(std::getline(lines, line)) {
+        if(line.compare(0, 6, "time: ") == 0) {
+            tables.push_back(smp_status_table{std::stoi(line.substr(6)), {}});
+            continue;
+        }
+        std::vector<std::string> fields = split_delim(line, "|");
+        if(tables.empty() || fields.size() < 7 || fields[1].find("core") != std::string::npos) {
+            continue;
+        }
+        auto trim = [](std::string field) {
+            field.erase(0, field.find_first_not_of(' '));
+            field.erase(field.find_last_not_of(' ') + 1);
+            return field;
+        };
+        tables.back().rows.push_back(smp_status_row{std::stoul(fields[1]), static_cast<unsigned int>(std::stoul(fields[2])),
+                                                    static_cast<unsigned int>(std::stoul(fields[5])), trim(fields[6])});
+    }
+    return tables;
+}
+
+/*
+    What the per-core execution logs say each core was doing, rebuilt from
+    the logs alone. A dispatch or steal starts a process on its core, an
+    async SYSCALL blocks it when the ISR returns, and an EXEC gives it a new
+    size when its IRET ends. FORK children are numbered in the order the
+    engine forks them (start time, then core) and start with their parent's
+    size. The logs do not say when a process exits, so a core is taken to
+    run its last process until it dispatches another one.
+*/
+class smp_log_model {
+public:
+    explicit smp_log_model(const std::vector<std::unique_ptr<event_recorder>>& logs) : timelines(logs.size()) {
+        struct fact {
+            int         time;
+            size_t      core;
+            size_t      order;
+            char        kind;   //R run, E exec, B block, C clone
+            long        value;
+        };
+        std::vector<fact> facts;
+        for(size_t core = 0; core < logs.size(); core++) {
+            const std::vector<event>& events = logs[core]->events;
+            long exec_size = -1;
+            bool blocking = false;
+            for(const event& e : events) {
+                if(e.kind == event_kind::DISPATCH || e.kind == event_kind::STEAL) {
+                    facts.push_back(fact{e.time, core, facts.size(), 'R', e.operand});
+                } else if(e.kind == event_kind::PROGRAM_SIZE) {
+                    exec_size = e.operand;
+                } else if(e.kind == event_kind::IRET && exec_size >= 0) {
+                    facts.push_back(fact{e.time + 1, core, facts.size(), 'E', exec_size});
+                    exec_size = -1;
+                } else if(e.kind == event_kind::IO_START) {
+                    blocking = true;
+                } else if(e.kind == event_kind::EPILOGUE && blocking) {
+                    facts.push_back(fact{e.time + e.duration + 2, core, facts.size(), 'B', 0});
+                    blocking = false;
+                } else if(e.kind == event_kind::CLONE_PCB) {
+                    facts.push_back(fact{e.time, core, facts.size(), 'C', 0});
+                }
+            }
+        }
+        std::sort(facts.begin(), facts.end(), [](const fact& lhs, const fact& rhs) {
+            return std::tie(lhs.time, lhs.core, lhs.order) < std::tie(rhs.time, rhs.core, rhs.order);
+        });
+
+        std::vector<core_state> current(logs.size());
+        sizes[0].push_back({0, 1});     //init
+        unsigned int next_pid = 1;
+        for(const fact& f : facts) {
+            core_state& state = current[f.core];
+            if(f.kind == 'R') {
+                state = core_state{f.time, f.value, false};
+            } else if(f.kind == 'B') {
+                state = core_state{f.time, state.pid, true};
+            } else if(f.kind == 'E') {
+                sizes[state.pid].push_back({f.time, static_cast<unsigned int>(f.value)});
+                continue;
+            } else {
+                sizes[next_pid++].push_back({f.time, size_at(state.pid, f.time, true)});
+                continue;
+            }
+            timelines[f.core].push_back(state);
+        }
+    }
+
+    /*
+        Checks a table against the logs; returns a description of the first
+        mismatch, or an empty string. Changes stamped at the table's own time
+        may or may not be in it, so a row only has to agree with the logs just
+        before or just after that time.
+    */
+    std::string check(const smp_status_table& table) const {
+        std::ostringstream problem;
+        for(size_t core = 0; core < timelines.size(); core++) {
+            core_state states[2] = {state_at(core, table.time, false), state_at(core, table.time, true)};
+
+            auto running = std::find_if(table.rows.begin(), table.rows.end(), [core](const smp_status_row& row) {
+                return row.core == core && row.state == "running";
+            });
+            if(running != table.rows.end()) {
+                bool matches = false;
+                for(int k = 0; k < 2; k++) {
+                    matches |= states[k].pid == running->pid && !states[k].blocked
+                               && size_at(running->pid, table.time, k == 1) == running->size;
+                }
+                if(!matches) {
+                    problem << "core " << core << " runs PID " << running->pid << " (" << running->size
+                            << " Mb), but its log has PID " << states[0].pid << " (" << size_at(states[0].pid, table.time, false)
+                            << " Mb)" << (states[0].blocked ? " blocked" : "");
+                    return problem.str();
+                }
+            }
+
+            //The process the log has running must not show up anywhere else
+            if(states[0].pid >= 0 && !states[0].blocked) {
+                for(const smp_status_row& row : table.rows) {
+                    bool blocked_now = row.state == "blocked" && blocks_at(core, row.pid, table.time);
+                    if(row.pid == states[0].pid && !(row.core == core && (row.state == "running" || blocked_now))) {
+                        problem << "PID " << row.pid << " is " << row.state << " on core " << row.core
+                                << ", but core " << core << "'s log has it running";
+                        return problem.str();
+                    }
+                }
+            }
+        }
+
+        for(const smp_status_row& row : table.rows) {
+            if(size_at(row.pid, table.time, false) != row.size && size_at(row.pid, table.time, true) != row.size) {
+                problem << "PID " << row.pid << " is shown with " << row.size << " Mb, but the logs give it "
+                        << size_at(row.pid, table.time, false) << " Mb";
+                return problem.str();
+            }
+        }
+        return problem.str();
+    }
+
+private:
+    struct core_state {
+        int     time = INT_MIN;
+        long    pid = -1;
+        bool    blocked = false;
+    };
+
+    std::vector<std::vector<core_state>> timelines;
+    std::unordered_map<long, std::vector<std::pair<int, unsigned int>>> sizes;
+
+    //The state of a core from its changes before time (or at it too, with inclusive)
+    core_state state_at(size_t core, int time, bool inclusive) const {
+        const std::vector<core_state>& timeline = timelines[core];
+        auto it = std::partition_point(timeline.begin(), timeline.end(), [&](const core_state& state) {
+            return inclusive ? state.time <= time : state.time < time;
+        });
+        return it == timeline.begin() ? core_state() : *(it - 1);
+    }
+
+    //True if the core's log blocks pid at exactly time (another change can follow it at the same time)
+    bool blocks_at(size_t core, long pid, int time) const {
+        const std::vector<core_state>& timeline = timelines[core];
+        auto it = std::partition_point(timeline.begin(), timeline.end(), [&](const core_state& state) { return state.time < time; });
+        for(; it != timeline.end() && it->time == time; ++it) {
+            if(it->blocked && it->pid == pid) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    unsigned int size_at(long pid, int time, bool inclusive) const {
+        auto found = sizes.find(pid);
+        if(found == sizes.end()) {
+            return 0;
+        }
+        unsigned int size = 0;
+        for(const auto& [when, value] : found->second) {
+            if(inclusive ? when <= time : when < time) {
+                size = value;
+            }
+        }
+        return size;
+    }
+};
+
+//Runs the workload on cores cores and checks every status table against the per-core logs; returns the mismatches
+size_t verify_smp_tables(const scenario_spec& spec, unsigned int cores, bool async_io) {
+    size_t mismatches = 0;
+    in_workload(spec, [&](const workload& w) {
+        Simulator simulator;
+        simulator.load_config("vector_table.txt", "device_table.txt", "external_files.txt");
+        const simulation_context& context = simulator.context();
+        compiled_trace trace = compile_trace(w.trace, context.external_files, context.tables());
+        partition_manager memory(load_partition_layout("partitions.txt"));
+
+        std::vector<std::unique_ptr<event_recorder>> recorders;
+        std::vector<std::unique_ptr<event_buffer>> buffers;
+        std::vector<event_buffer*> logs;
+        for(unsigned int k = 0; k < cores; k++) {
+            recorders.push_back(std::make_unique<event_recorder>());
+            buffers.push_back(std::make_unique<event_buffer>(*recorders.back()));
+            logs.push_back(buffers.back().get());
+        }
+        string_sink status;
+        simulate_smp(context, trace, memory, logs, status, async_io);
+
+        smp_log_model model(recorders);
+        std::vector<smp_status_table> tables = parse_smp_status(status.str());
+        for(const smp_status_table& table : tables) {
+            std::string problem = model.check(table);
+            if(!problem.empty() && mismatches++ < 3) {
+                std::cerr << "  " << spec.name << " on " << cores << " core(s)" << (async_io ? " with async I/O" : "")
+                          << ", table at " << table.time << ": " << problem << std::endl;
+            }
+        }
+        std::cerr << std::left << std::setw(22) << spec.name << std::right << std::setw(8) << spec.scale
+                  << std::setw(4) << cores << " core(s)" << (async_io ? " async" : "      ")
+                  << std::setw(8) << tables.size() << " tables" << std::setw(8) << mismatches << " mismatched" << std::endl;
+    });
+    return mismatches;
+}
+
+/*
+    --verify: checks the status tables of every scenario. Tables kept as
+    deltas (status_history, at several keyframe intervals) must render
+    exactly as append_system_status writes them, for a random stream of
+    tables and for each scenario's snapshots. SMP tables, on 2 and 4 cores
+    with and without async I/O, are compared with what the per-core
+    execution logs say each core was doing at the table's time.
+    returns the exit code: 0 if everything matched
+*/
+int verify_all(const std::vector<scenario_spec>& specs) {
+    size_t mismatches = 0;
+    try {
+        snapshot_tee random;
+        feed_random_snapshots(random, 5000);
+        mismatches += random.check("random_tables");
+        for(const auto& spec : specs) {
+            mismatches += verify_status_history(spec);
+        }
+        for(const auto& spec : specs) {
+            for(unsigned int cores : {2u, 4u}) {
+                for(bool async_io : {false, true}) {
+                    mismatches += verify_smp_tables(spec, cores, async_io);
+                }
+            }
+        }
+    } catch(const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    std::cerr << (mismatches == 0 ? "All status tables match" : "Status tables do not match") << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    std::string output_path = "benchmark_results.json";
+    std::vector<scenario_spec> specs;
+    bool quick = false;
+    bool policies = false;
+    bool verify = false;
+    double min_seconds = 1.0;
+
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if(option == "--quick") {
+            quick = true;
+            min_seconds = 0.2;
+            continue;
+        }
+        if(option == "--policies") {
+            policies = true;
+            continue;
+        }
+        if(option == "--verify") {
+            verify = true;
+            continue;
+        }
+        if(i + 1 >= argc) {
+            std::cerr << "Error: " << option << " expects a value" << std::endl;
+            return 1;
+        }
+        try {
+            if(option == "--output") {
+                output_path = argv[++i];
+            } else if(option == "--min-time") {
+                min_seconds = std::stod(argv[++i]);
+            } else if(option == "--scenario") {
+                //name or name:scale, may be repeated
+                auto fields = split_delim(argv[++i], ":");
+                specs.push_back(scenario_spec{fields[0], fields.size() > 1 ? static_cast<unsigned int>(std::stoul(fields[1])) : 0});
+            } else {
+                std::cerr << "Error: unknown option " << option << std::endl;
+                std::cout << "To run the program, do: ./benchmark [--quick] [--policies | --verify] [--output <file|->] [--min-time <seconds>] [--scenario <name[:scale]>]..." << std::endl;
+                return 1;
+            }
+        } catch(const std::exception&) {
+            std::cerr << "Error: invalid value for " << option << ": " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    //Scenarios given without a scale use the default one
+    std::vector<scenario_spec> defaults = default_scenarios(quick);
+    if(specs.empty()) {
+        specs = defaults;
+    }
+    for(auto& spec : specs) {
+        for(const auto& fallback : defaults) {
+            if(spec.scale == 0 && spec.name == fallback.name) {
+                spec.scale = fallback.scale;
+            }
+        }
+    }
+
+    if(policies) {
+        return compare_all_policies(specs, quick, min_seconds, output_path);
+    }
+    if(verify) {
+        return verify_all(specs);
+    }
+
+    std::vector<scenario_result> results;
+    try {
+        for(const auto& spec : specs) {
+            scenario_result r = run_scenario(spec, min_seconds, 3);
+            std::cerr << std::left << std::setw(22) << r.name << std::right << std::setw(8) << r.scale
+                      << std::fixed << std::setprecision(0)
+                      << std::setw(14) << r.events_per_second << " events/s"
+                      << std::setprecision(1) << std::setw(10) << r.ns_per_line << " ns/line"
+                      << std::setw(12) << r.allocations_per_run << " allocs/run"
+                      << std::setw(10) << r.peak_rss_kb << " KiB peak" << std::endl;
+            std::cerr.unsetf(std::ios::floatfield);
+            results.push_back(r);
+        }
+    } catch(const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    return write_results(output_path, [&](std::ostream& out) { write_json(out, results); });
+}
@@ -5,4 +5,7 @@ else
     rm bin/*
     rm -rf execution.txt
 fi
-g++ -g -O0 -I . -o bin/interrupts interrupts.cpp
+g++ -std=c++17 -g -O2 -pthread -I . -o bin/interrupts Interrupts_101166589_101257741.cpp
+g++ -std=c++17 -g -O2 -I . -o bin/event_log_convert event_log_convert.cpp
+g++ -std=c++17 -g -O2 -I . -o bin/trace_generator trace_generator.cpp
+g++ -std=c++17 -g -O2 -pthread -I . -o bin/benchmark benchmark.cpp
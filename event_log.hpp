@@ -0,0 +1,299 @@
+/**
+ *
+ * @file event_log.hpp
+ * @brief Compact binary event log: writer used by the simulator and a memory-mapped reader
+ *
+ */
+
+#ifndef EVENT_LOG_HPP_
+#define EVENT_LOG_HPP_
+
+#include "Interrupts_101166589_101257741.hpp"
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define EVENT_LOG_MAGIC     "SIMEVLOG"
+#define EVENT_LOG_VERSION   2   //2: interrupt prologues/epilogues are single PROLOGUE/EPILOGUE records
+
+/*
+    Layout of a binary event log (native byte order):
+        event_log_header
+        vector table    (vector_count strings)
+        program table   (program_count strings)
+        event_log_record, repeated until the end of the file
+    Each string is a uint32_t length followed by its bytes, padded to 4 bytes.
+*/
+struct event_log_header {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    record_size;
+    uint32_t    vector_count;
+    uint32_t    program_count;
+};
+
+enum class record_type : uint8_t {
+    EVENT,      //values: time, duration, operand
+    SNAPSHOT,   //values: time, duration, number of PCB rows that follow; kind is the trace opcode
+    PCB_ROW     //values: PID, PPID, program id, partition number, size; kind is 0 running / 1 waiting
+};
+
+struct event_log_record {
+    record_type type;
+    uint8_t     kind;
+    uint16_t    reserved;
+    int32_t     values[5];
+};
+
+static_assert(sizeof(event_log_header) == 24, "event_log_header must stay 24 bytes");
+static_assert(sizeof(event_log_record) == 24, "event_log_record must stay 24 bytes");
+
+//Writes the binary log into a sink; program names are stored once in the header tables
+class binary_event_writer : public event_writer {
+public:
+    binary_event_writer(output_sink& _sink, const std::vector<std::string>& vectors,
+                        const std::vector<symbol>& programs): sink(_sink) {
+        event_log_header header{};
+        std::memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+        header.version       = EVENT_LOG_VERSION;
+        header.record_size   = sizeof(event_log_record);
+        header.vector_count  = vectors.size();
+        header.program_count = programs.size();
+        sink.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for(const auto& vector : vectors) {
+            write_string(vector);
+        }
+        for(size_t id = 0; id < programs.size(); id++) {
+            write_string(symbol_name(programs[id]));
+            program_ids.emplace(programs[id], id);
+        }
+    }
+
+    void write_events(const event* events, size_t count) override {
+        for(size_t k = 0; k < count; k++) {
+            event_log_record record{record_type::EVENT, static_cast<uint8_t>(events[k].kind), 0,
+                                    {events[k].time, events[k].duration, events[k].operand, 0, 0}};
+            write_record(record);
+        }
+    }
+
+    void write_snapshot(int time, opcode trace_type, int duration, const PCB& running_pcb,
+                        const PCB* first_waiting, const wait_queue& waiting) override {
+        int32_t rows = 1 + (first_waiting != nullptr) + waiting.size();
+        event_log_record record{record_type::SNAPSHOT, static_cast<uint8_t>(trace_type), 0,
+                                {time, duration, rows, 0, 0}};
+        write_record(record);
+
+        write_pcb(running_pcb, 0);
+        if(first_waiting != nullptr) {
+            write_pcb(*first_waiting, 1);
+        }
+        waiting.for_each([&](const PCB& pcb) {
+            write_pcb(pcb, 1);
+        });
+    }
+
+    void flush() override {
+        sink.flush();
+    }
+
+private:
+    output_sink& sink;
+    std::unordered_map<symbol, int> program_ids;
+
+    void write_string(const std::string& text) {
+        uint32_t length = text.size();
+        sink.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        sink.write(text.data(), text.size());
+        static const char padding[4] = {0, 0, 0, 0};
+        sink.write(padding, (4 - text.size() % 4) % 4);
+    }
+
+    void write_record(const event_log_record& record) {
+        sink.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+
+    void write_pcb(const PCB& pcb, uint8_t state) {
+        auto it = program_ids.find(pcb.program);
+        int program_id = it == program_ids.end() ? -1 : it->second;
+        event_log_record record{record_type::PCB_ROW, state, 0,
+                                {static_cast<int32_t>(pcb.PID), pcb.PPID, program_id,
+                                 pcb.partition_number, static_cast<int32_t>(pcb.size)}};
+        write_record(record);
+    }
+};
+
+/*
+    Read-only view of a binary event log. The file is memory-mapped (read into
+    memory on platforms without mmap) and records are used in place.
+*/
+class event_log_reader {
+public:
+    event_log_reader() = default;
+    event_log_reader(const event_log_reader&) = delete;
+    event_log_reader& operator=(const event_log_reader&) = delete;
+
+    ~event_log_reader() {
+        close();
+    }
+
+    //Maps the file and checks the header; on failure error() says why
+    bool open(const std::string& path) {
+        close();
+        error_message.clear();
+        if(!map_file(path)) {
+            return false;
+        }
+
+        if(size < sizeof(event_log_header)) {
+            return fail("file too small for an event log header");
+        }
+        event_log_header header;
+        std::memcpy(&header, data, sizeof(header));
+        if(std::memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) != 0) {
+            return fail("not an event log (bad magic)");
+        }
+        if(header.version != EVENT_LOG_VERSION) {
+            return fail("unsupported event log version " + std::to_string(header.version));
+        }
+        if(header.record_size != sizeof(event_log_record)) {
+            return fail("unexpected record size " + std::to_string(header.record_size));
+        }
+
+        size_t offset = sizeof(header);
+        if(!read_strings(header.vector_count, offset, vectors)
+           || !read_strings(header.program_count, offset, programs)) {
+            return fail("truncated string tables");
+        }
+        if((size - offset) % sizeof(event_log_record) != 0) {
+            return fail("truncated record at end of file");
+        }
+
+        records = reinterpret_cast<const event_log_record*>(data + offset);
+        record_count = (size - offset) / sizeof(event_log_record);
+        return true;
+    }
+
+    const std::string& error() const {
+        return error_message;
+    }
+
+    const std::vector<std::string>& vector_table() const {
+        return vectors;
+    }
+
+    const std::vector<std::string>& program_table() const {
+        return programs;
+    }
+
+    //Name for a program id stored in a PCB row
+    const std::string& program_name(int id) const {
+        static const std::string unknown = "unknown";
+        return id >= 0 && static_cast<size_t>(id) < programs.size() ? programs[id] : unknown;
+    }
+
+    const event_log_record* begin() const {
+        return records;
+    }
+
+    const event_log_record* end() const {
+        return records + record_count;
+    }
+
+    size_t size_in_records() const {
+        return record_count;
+    }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::vector<char> fallback;
+    const event_log_record* records = nullptr;
+    size_t record_count = 0;
+    std::vector<std::string> vectors;
+    std::vector<std::string> programs;
+    std::string error_message;
+
+    bool fail(const std::string& message) {
+        error_message = message;
+        close();
+        return false;
+    }
+
+    bool map_file(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return fail("unable to open " + path);
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0) {
+            ::close(fd);
+            return fail("unable to stat " + path);
+        }
+        size = info.st_size;
+        if(size > 0) {
+            void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(address == MAP_FAILED) {
+                ::close(fd);
+                return fail("unable to map " + path);
+            }
+            data = static_cast<const char*>(address);
+            mapped = true;
+        }
+        ::close(fd);
+        return true;
+#else
+        std::ifstream input(path, std::ios::binary);
+        if(!input.is_open()) {
+            return fail("unable to open " + path);
+        }
+        fallback.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        data = fallback.data();
+        size = fallback.size();
+        return true;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if(mapped) {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+        mapped = false;
+        fallback.clear();
+        data = nullptr;
+        size = 0;
+        records = nullptr;
+        record_count = 0;
+        vectors.clear();
+        programs.clear();
+    }
+
+    bool read_strings(uint32_t count, size_t& offset, std::vector<std::string>& out) {
+        for(uint32_t k = 0; k < count; k++) {
+            uint32_t length;
+            if(offset + sizeof(length) > size) {
+                return false;
+            }
+            std::memcpy(&length, data + offset, sizeof(length));
+            offset += sizeof(length);
+            if(offset + length > size) {
+                return false;
+            }
+            out.emplace_back(data + offset, length);
+            offset += length + (4 - length % 4) % 4;
+        }
+        return offset <= size;
+    }
+};
+
+#endif
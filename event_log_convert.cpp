@@ -0,0 +1,72 @@
+/**
+ *
+ * @file event_log_convert.cpp
+ * @brief Converts a binary event log (written with --binary) back into the text output files
+ *
+ */
+
+#include "event_log.hpp"
+
+int main(int argc, char** argv) {
+    if(argc != 4) {
+        std::cout << "ERROR!\nExpected 3 argument, received " << argc - 1 << std::endl;
+        std::cout << "To run the program, do: ./event_log_convert <event_log.bin> <execution.txt|-> <system_status.txt|->" << std::endl;
+        return 1;
+    }
+
+    event_log_reader reader;
+    if(!reader.open(argv[1])) {
+        std::cerr << "Error: " << argv[1] << ": " << reader.error() << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<output_sink> execution;
+    std::unique_ptr<output_sink> system_status;
+    try {
+        execution = open_sink(argv[2]);
+        system_status = open_sink(argv[3]);
+    } catch(const simulator_error& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    event_formatter formatter(reader.vector_table());
+
+    for(const event_log_record* record = reader.begin(); record != reader.end(); record++) {
+        if(record->type == record_type::EVENT) {
+            event e{record->values[0], record->values[1], static_cast<event_kind>(record->kind), record->values[2]};
+            bool vectored = e.kind == event_kind::PROLOGUE || e.kind == event_kind::FIND_VECTOR || e.kind == event_kind::LOAD_ADDRESS;
+            if(vectored && (e.operand < 0 || static_cast<size_t>(e.operand) >= reader.vector_table().size())) {
+                std::cerr << "Error: " << argv[1] << ": event at record " << (record - reader.begin()) << " names interrupt "
+                          << e.operand << ", which is not in the log's vector table" << std::endl;
+                return 1;
+            }
+            formatter.render(e, *execution);
+        } else if(record->type == record_type::SNAPSHOT) {
+            int rows = record->values[2];
+            if(rows < 1 || reader.end() - record - 1 < rows) {
+                std::cerr << "Error: " << argv[1] << ": snapshot at record " << (record - reader.begin())
+                          << " is missing its PCB rows" << std::endl;
+                return 1;
+            }
+
+            const event_log_record* header = record;
+            auto to_pcb = [&reader](const event_log_record* row) {
+                return PCB(row->values[0], row->values[1], intern(reader.program_name(row->values[2])),
+                           row->values[4], row->values[3]);
+            };
+
+            PCB running_pcb = to_pcb(++record);
+            wait_queue waiting;
+            for(int k = 1; k < rows; k++) {
+                waiting = waiting.push(to_pcb(++record));
+            }
+
+            append_system_status(*system_status, header->values[0], opcode_name(static_cast<opcode>(header->kind)),
+                                 header->values[1], running_pcb, nullptr, waiting);
+        }
+    }
+
+    execution->flush();
+    system_status->flush();
+    return 0;
+}
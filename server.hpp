@@ -0,0 +1,388 @@
+/**
+ *
+ * @file server.hpp
+ * @brief Server mode (--serve): runs traces submitted over a Unix socket or stdin against a configuration loaded once
+ *
+ */
+
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include "simulator.hpp"
+#include <condition_variable>
+#include <deque>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/*
+    Wire format, the same on a socket and on stdin/stdout. A request is one
+    header line followed by the trace text:
+        RUN <id> <bytes>\n<bytes of trace>
+    The id is any word; it comes back in the reply, which is either
+        OK <id> <end_time> <events> <execution_bytes> <status_bytes>\n<execution><status>
+    or, when the trace cannot be run,
+        ERROR <id> <message>\n
+    A header that cannot be parsed gets "ERROR - <message>" and ends the session.
+*/
+struct serve_request {
+    std::string id;
+    std::string trace;
+};
+
+//Buffered reads of requests from a file descriptor
+class request_reader {
+public:
+    explicit request_reader(int _fd) : fd(_fd) {}
+
+    //Reads the next request; false at the end of the input. Throws simulator_error for a malformed header.
+    bool next(serve_request& request) {
+        std::string line;
+        if(!read_line(line)) {
+            return false;
+        }
+
+        std::istringstream header(line);
+        std::string verb;
+        size_t bytes = 0;
+        if(!(header >> verb >> request.id >> bytes) || verb != "RUN") {
+            throw simulator_error("expected RUN <id> <bytes>, got \"" + line + "\"");
+        }
+        if(bytes > MAX_TRACE_BYTES) {
+            throw simulator_error("trace of " + std::to_string(bytes) + " bytes is too large");
+        }
+        request.trace.resize(bytes);
+        if(!read_exact(&request.trace[0], bytes)) {
+            throw simulator_error("input ended inside the trace of request " + request.id);
+        }
+        return true;
+    }
+
+private:
+    static const size_t MAX_TRACE_BYTES = 256u << 20;
+
+    int fd;
+    char buffer[64 * 1024];
+    size_t start = 0;
+    size_t end = 0;
+
+    bool fill() {
+        start = 0;
+        end = 0;
+        while(true) {
+            ssize_t got = ::read(fd, buffer, sizeof(buffer));
+            if(got > 0) {
+                end = got;
+                return true;
+            }
+            if(got == 0 || errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    bool read_line(std::string& line) {
+        line.clear();
+        while(true) {
+            if(start == end && !fill()) {
+                return !line.empty();
+            }
+            const char* newline = static_cast<const char*>(memchr(buffer + start, '\n', end - start));
+            size_t stop = newline ? newline - buffer : end;
+            line.append(buffer + start, stop - start);
+            start = newline ? stop + 1 : end;
+            if(newline) {
+                if(!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                return true;
+            }
+        }
+    }
+
+    bool read_exact(char* out, size_t length) {
+        while(length > 0) {
+            if(start == end && !fill()) {
+                return false;
+            }
+            size_t take = std::min(length, end - start);
+            memcpy(out, buffer + start, take);
+            start += take;
+            out += take;
+            length -= take;
+        }
+        return true;
+    }
+};
+
+//Writes a handful of pieces, in order, with as few system calls as it takes; false if the peer went away
+bool write_pieces(int fd, std::vector<std::string_view> pieces) {
+    std::vector<iovec> vectors;
+    for(std::string_view piece : pieces) {
+        if(!piece.empty()) {
+            vectors.push_back(iovec{const_cast<char*>(piece.data()), piece.size()});
+        }
+    }
+
+    size_t first = 0;
+    while(first < vectors.size()) {
+        ssize_t wrote = ::writev(fd, &vectors[first], vectors.size() - first);
+        if(wrote < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        //Skip what went out, possibly ending inside a piece
+        size_t left = wrote;
+        while(first < vectors.size() && left >= vectors[first].iov_len) {
+            left -= vectors[first++].iov_len;
+        }
+        if(left > 0) {
+            vectors[first].iov_base = static_cast<char*>(vectors[first].iov_base) + left;
+            vectors[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+//Error replies are one line
+std::string error_reply(const std::string& id, std::string message) {
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    return "ERROR " + id + " " + message + "\n";
+}
+
+/*
+    Runs one request on a worker's simulator and writes the reply to fd. The
+    simulator is reset first, so its captured output is just this trace's and
+    nothing a failed request left pending leaks into it. Interrupt numbers are
+    checked against the tables when the trace is compiled; anything the run
+    throws becomes an ERROR reply, so one bad trace never takes the worker (or
+    the server) down with it. Only simulator_error messages reach the client.
+    returns false if the reply could not be written
+*/
+bool serve_one(Simulator& simulator, const serve_request& request, int fd, std::mutex* output_lock) {
+    std::string head;
+    Simulator::run_result result;
+    bool ok = false;
+    try {
+        simulator.reset();
+        result = simulator.run_text(request.trace, "request " + request.id);
+        ok = true;
+    } catch(const simulator_error& error) {
+        head = error_reply(request.id, error.what());
+    } catch(const std::exception&) {
+        head = error_reply(request.id, "internal error while running the trace");
+    }
+
+    std::string_view execution;
+    std::string_view status;
+    if(ok) {
+        execution = simulator.execution_output();
+        status = simulator.status_output();
+        head = "OK " + request.id + " " + std::to_string(result.end_time) + " " + std::to_string(result.events) + " "
+               + std::to_string(execution.size()) + " " + std::to_string(status.size()) + "\n";
+    }
+
+    std::unique_lock<std::mutex> guard;
+    if(output_lock != nullptr) {
+        guard = std::unique_lock<std::mutex>(*output_lock);
+    }
+    return write_pieces(fd, {head, execution, status});
+}
+
+//Queue of work shared by the server's threads; pop() waits, and returns false once the queue is closed and drained
+template<typename T>
+class work_queue {
+public:
+    void push(T item) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            items.push_back(std::move(item));
+        }
+        ready.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this]() { return closed || !items.empty(); });
+        if(items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<T> items;
+    bool closed = false;
+};
+
+//A worker's simulator, set up from the command line options like a batch worker's
+std::unique_ptr<Simulator> make_server_simulator(std::shared_ptr<const simulation_context> context, const run_options& options,
+                                                 const std::vector<unsigned int>& layout) {
+    auto simulator = std::make_unique<Simulator>(std::move(context));
+    simulator->set_status_time(options.status_time);
+    simulator->memoize_exec(options.memo_exec);
+    simulator->set_memory_mode(options.memory, options.memory_size);
+    simulator->set_placement(options.placement);
+    simulator->set_partition_layout(layout);
+    return simulator;
+}
+
+unsigned int server_threads(const run_options& options) {
+    return options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+    Serves requests read from stdin, replying on stdout. Workers take requests
+    as they are read, so replies come back in the order runs finish; match
+    them by id. Returns at the end of stdin, once every reply is written.
+*/
+void serve_stream(std::shared_ptr<const simulation_context> context, const run_options& options,
+                  const std::vector<unsigned int>& layout, std::ostream& log) {
+    unsigned int thread_count = server_threads(options);
+    work_queue<serve_request> requests;
+    std::mutex output_lock;
+    std::atomic<size_t> served{0};
+
+    std::vector<std::thread> workers;
+    for(unsigned int t = 0; t < thread_count; t++) {
+        workers.emplace_back([&]() {
+            std::unique_ptr<Simulator> simulator = make_server_simulator(context, options, layout);
+            serve_request request;
+            while(requests.pop(request)) {
+                serve_one(*simulator, request, STDOUT_FILENO, &output_lock);
+                served++;
+            }
+        });
+    }
+    log << "Serving stdin on " << thread_count << " thread(s)" << std::endl;
+
+    request_reader reader(STDIN_FILENO);
+    try {
+        serve_request request;
+        while(reader.next(request)) {
+            requests.push(std::move(request));
+        }
+    } catch(const std::exception& error) {
+        std::lock_guard<std::mutex> guard(output_lock);
+        write_pieces(STDOUT_FILENO, {error_reply("-", error.what())});
+    }
+
+    requests.close();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    log << "Served " << served << " request(s)" << std::endl;
+}
+
+//Path of the listening socket, removed when SIGINT or SIGTERM stops the server
+static char server_socket_path[sizeof(sockaddr_un::sun_path)];
+
+extern "C" void stop_server(int) {
+    ::unlink(server_socket_path);
+    ::_exit(0);
+}
+
+/*
+    Listens on a Unix domain socket at path. Each connection is a session of
+    requests answered in order; up to --jobs sessions run at once and later
+    ones wait for a free worker. A stale socket file is replaced. Runs until
+    the process is stopped (SIGINT or SIGTERM, which remove the socket file).
+*/
+void serve_socket(std::shared_ptr<const simulation_context> context, const run_options& options,
+                  const std::vector<unsigned int>& layout, const std::string& path, std::ostream& log) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)) {
+        throw simulator_error("socket path is too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    struct stat existing;
+    if(::lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        ::unlink(path.c_str());
+    }
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+       || ::listen(listener, SOMAXCONN) != 0) {
+        std::string reason = strerror(errno);
+        if(listener >= 0) {
+            ::close(listener);
+        }
+        throw simulator_error("cannot listen on " + path + ": " + reason);
+    }
+
+    memcpy(server_socket_path, address.sun_path, sizeof(server_socket_path));
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+    std::signal(SIGPIPE, SIG_IGN);  //a client that hangs up only ends its own session
+
+    unsigned int thread_count = server_threads(options);
+    work_queue<int> connections;
+    for(unsigned int t = 0; t < thread_count; t++) {
+        std::thread([&connections, context, &options, &layout]() {
+            std::unique_ptr<Simulator> simulator = make_server_simulator(context, options, layout);
+            int fd;
+            while(connections.pop(fd)) {
+                request_reader reader(fd);
+                try {
+                    serve_request request;
+                    while(reader.next(request) && serve_one(*simulator, request, fd, nullptr)) {
+                    }
+                } catch(const std::exception& error) {
+                    write_pieces(fd, {error_reply("-", error.what())});
+                }
+                ::close(fd);
+            }
+        }).detach();
+    }
+    log << "Serving " << path << " on " << thread_count << " thread(s)" << std::endl;
+
+    //Out of descriptors or similar: report it and keep serving once sessions have ended
+    while(true) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if(fd >= 0) {
+            connections.push(fd);
+        } else if(errno != EINTR && errno != ECONNABORTED) {
+            log << "accept failed on " << path << ": " << strerror(errno) << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+#endif
+
+/*
+    Serves --serve requests on path, a Unix socket, or "-" for stdin/stdout.
+    Every worker shares the context main() loaded, so nothing is read again.
+*/
+void run_server(std::shared_ptr<const simulation_context> context, const run_options& options,
+                const std::vector<unsigned int>& layout, const std::string& path, std::ostream& log) {
+#ifdef _WIN32
+    throw simulator_error("--serve needs a POSIX system");
+#else
+    if(path == "-") {
+        serve_stream(std::move(context), options, layout, log);
+    } else {
+        serve_socket(std::move(context), options, layout, path, log);
+    }
+#endif
+}
+
+#endif
@@ -0,0 +1,757 @@
+/**
+ *
+ * @file simulator.hpp
+ * @brief The simulation engine and an embeddable Simulator that can run many traces in one process
+ *
+ */
+
+#ifndef SIMULATOR_HPP_
+#define SIMULATOR_HPP_
+
+#include "Interrupts_101166589_101257741.hpp"
+#include "event_log.hpp"
+
+/*
+    Memo of exec'd program runs (--memo-exec). What an exec'd program does
+    depends only on the program, its PCB, the wait queue it starts with and
+    which partitions are free; the start time only shifts it. The first run
+    from a given state is recorded: its events and snapshots relative to the
+    start, the partitions it leaves changed and its stat counters. Later EXECs
+    from the same state replay that recording instead of simulating again.
+    Recordings stop being kept once max_events events are cached, and the
+    tape of the open ones is never allowed to grow past what is left.
+*/
+class exec_memo {
+public:
+    //A recorded run of one program from one starting state
+    struct entry {
+        size_t                                          hash = 0;
+        int                                             program_id = -1;
+        PCB                                             pcb = PCB(0, -1, symbol_table::EMPTY, 0, -1);
+        wait_queue                                      waiting;
+        std::vector<uint64_t>                           free_mask;  //bit k set: partition k+1 is free
+        bool                                            stats = false;  //recorded with stats on
+        int                                             duration = 0;
+        std::vector<event>                              events;
+        std::vector<event_buffer::recorded_snapshot>    snapshots;
+        std::vector<std::pair<int, int>>                partitions; //partition number, owner at the end
+        uint64_t                                        counters[static_cast<size_t>(stat_counter::COUNT)] = {};
+    };
+
+    explicit exec_memo(size_t _max_events = size_t(1) << 22) : max_events(_max_events) {}
+
+    void clear() {
+        entries.clear();
+        open.clear();
+        cached_events = 0;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    //Abandons the open recordings of a run that failed part way; the finished ones are kept
+    void abort() {
+        open.clear();
+    }
+
+    //The recording of program_id from this state, or nullptr; the state is kept for begin()
+    const entry* find(int program_id, const PCB& pcb, const wait_queue& waiting, const partition_manager& memory) {
+        probe.program_id = program_id;
+        probe.pcb = pcb;
+        probe.waiting = waiting;
+        probe.stats = active_stats != nullptr;
+        probe.free_mask.assign((memory.count() + 63) / 64, 0);
+        for(size_t k = 0; k < memory.count(); k++) {
+            if(memory[k].owner == NO_OWNER) {
+                probe.free_mask[k / 64] |= uint64_t(1) << (k % 64);
+            }
+        }
+        probe.hash = fingerprint(probe);
+
+        auto range = entries.equal_range(probe.hash);
+        for(auto it = range.first; it != range.second; ++it) {
+            const entry& candidate = it->second;
+            if(candidate.program_id == probe.program_id && candidate.stats == probe.stats
+               && candidate.pcb.PID == pcb.PID && candidate.pcb.PPID == pcb.PPID && candidate.pcb.size == pcb.size
+               && candidate.pcb.partition_number == pcb.partition_number
+               && candidate.free_mask == probe.free_mask && candidate.waiting.same_as(waiting)) {
+                return &candidate;
+            }
+        }
+        return nullptr;
+    }
+
+    //Replays a recording from time and returns when it ends
+    int replay(const entry& recorded, int time, partition_manager& memory, event_buffer& execution) const {
+        STATS_COUNT(EXEC_REPLAY);
+        size_t next_snapshot = 0;
+        for(size_t k = 0; k <= recorded.events.size(); k++) {
+            for(; next_snapshot < recorded.snapshots.size() && recorded.snapshots[next_snapshot].position == k; next_snapshot++) {
+                const auto& snapshot = recorded.snapshots[next_snapshot];
+                execution.snapshot(time + snapshot.time, snapshot.trace_type, snapshot.duration, snapshot.running_pcb,
+                                   snapshot.first_waiting ? &*snapshot.first_waiting : nullptr, snapshot.waiting);
+            }
+            if(k < recorded.events.size()) {
+                const event& e = recorded.events[k];
+                execution.emit(time + e.time, e.duration, e.kind, e.operand);
+            }
+        }
+
+        for(const auto& [partition_number, owner] : recorded.partitions) {
+            if(owner == NO_OWNER) {
+                memory.release(partition_number);
+            } else {
+                memory.occupy(partition_number, owner, 0);   //sizes only matter to analytics, which never replay
+            }
+        }
+        if(active_stats != nullptr) {
+            for(size_t k = 0; k < static_cast<size_t>(stat_counter::COUNT); k++) {
+                active_stats->counters[k] += recorded.counters[k];
+            }
+        }
+        return time + recorded.duration;
+    }
+
+    //Starts recording the run find() was just asked about (and did not have); false if the memo is full
+    bool begin(int time, const partition_manager& memory, event_buffer& execution) {
+        if(cached_events >= max_events) {
+            return false;
+        }
+        execution.start_recording(max_events - cached_events);
+        open.push_back(open_recording{std::move(probe), time, execution.tape_events().size(),
+                                      execution.tape_snapshot_list().size(), {}, {}});
+        open_recording& recording = open.back();
+        for(size_t k = 0; k < memory.count(); k++) {
+            recording.owners.push_back(memory[k].owner);
+        }
+        if(active_stats != nullptr) {
+            std::copy(std::begin(active_stats->counters), std::end(active_stats->counters), recording.counters);
+        }
+        return true;
+    }
+
+    //Closes the innermost recording at time and keeps it, unless the memo is full or the tape overflowed
+    void end(int time, const partition_manager& memory, event_buffer& execution) {
+        open_recording recording = std::move(open.back());
+        open.pop_back();
+
+        const std::vector<event>& tape = execution.tape_events();
+        size_t events = execution.tape_overflowed() ? 0 : tape.size() - recording.first_event;
+        if(!execution.tape_overflowed() && cached_events + events <= max_events) {
+            entry& recorded = recording.state;
+            recorded.duration = time - recording.start;
+            recorded.events.reserve(events);
+            for(size_t k = recording.first_event; k < tape.size(); k++) {
+                event e = tape[k];
+                e.time -= recording.start;
+                recorded.events.push_back(e);
+            }
+            const auto& snapshots = execution.tape_snapshot_list();
+            for(size_t k = recording.first_snapshot; k < snapshots.size(); k++) {
+                auto snapshot = snapshots[k];
+                snapshot.position -= recording.first_event;
+                snapshot.time -= recording.start;
+                recorded.snapshots.push_back(std::move(snapshot));
+            }
+            for(size_t k = 0; k < memory.count(); k++) {
+                if(memory[k].owner != recording.owners[k]) {
+                    recorded.partitions.emplace_back(memory[k].partition_number, memory[k].owner);
+                }
+            }
+            //Snapshots and events are counted again as they are replayed
+            if(active_stats != nullptr) {
+                for(size_t k = 0; k < static_cast<size_t>(stat_counter::COUNT); k++) {
+                    bool replayed = k == static_cast<size_t>(stat_counter::SNAPSHOT) || k == static_cast<size_t>(stat_counter::EVENT)
+                                 || k == static_cast<size_t>(stat_counter::EXEC_REPLAY);
+                    recorded.counters[k] = replayed ? 0 : active_stats->counters[k] - recording.counters[k];
+                }
+            }
+            cached_events += events;
+            entries.emplace(recorded.hash, std::move(recorded));
+        }
+        execution.stop_recording();
+    }
+
+private:
+    struct open_recording {
+        entry       state;
+        int         start;
+        size_t      first_event;
+        size_t      first_snapshot;
+        std::vector<int> owners;
+        uint64_t    counters[static_cast<size_t>(stat_counter::COUNT)];
+    };
+
+    size_t max_events;
+    size_t cached_events = 0;
+    std::unordered_multimap<size_t, entry> entries;
+    std::vector<open_recording> open;
+    entry probe;
+
+    static size_t fingerprint(const entry& state) {
+        size_t hash = 14695981039346656037ULL;
+        auto mix = [&hash](uint64_t value) {
+            hash = (hash ^ value) * 1099511628211ULL;
+        };
+        mix(state.program_id);
+        mix(state.stats);
+        mix(state.pcb.PID);
+        mix(static_cast<uint64_t>(state.pcb.PPID));
+        mix(state.pcb.size);
+        mix(static_cast<uint64_t>(state.pcb.partition_number));
+        state.waiting.for_each([&](const PCB& pcb) {
+            mix(pcb.PID);
+            mix(static_cast<uint64_t>(pcb.partition_number));
+            mix(pcb.program);
+        });
+        for(uint64_t word : state.free_mask) {
+            mix(word);
+        }
+        return hash;
+    }
+};
+
+/*
+    Runs a compiled trace for the given process. FORK and EXEC push a new frame
+    for the child (or exec'd program) instead of recursing, so the depth of the
+    process tree is bounded by memory rather than by the native stack. Each frame
+    only carries its own PCB, wait queue and position; the tables come from the
+    shared context. All partition state lives in the given manager, so any number
+    of simulations can run side by side. The frame stack is passed in so callers
+    running many traces can keep its allocation. With a memo, EXECs that start
+    from a state seen before are replayed from it instead of simulated; the
+    memo must only be used with one partition layout.
+
+    The loop is instantiated once per allocator: memory is a resolved_partitions
+    (see simulate_trace below), so placement is not dispatched on every call.
+
+    returns the simulation time when the trace (and everything it started) ends
+*/
+template<typename Memory>
+int simulate_trace_on(const simulation_context& context, const compiled_trace& trace, int time, PCB init, wait_queue init_wait_queue,
+                      Memory& memory, event_buffer& execution, std::vector<process_frame>& frames, exec_memo* memo) {
+
+    STATS_TIMER(SIMULATION);
+    int current_time = time;
+    const std::vector<int>& delays = context.delays;
+
+    frames.clear();
+    frames.push_back(process_frame{&trace, &trace.blocks[0], 0, 0, init, std::move(init_wait_queue), -1});
+
+    while(!frames.empty()) {
+        process_frame& frame = frames.back();
+
+        //The process is done: the one it was started from picks up where it left off
+        if(frame.ip >= frame.block->size()) {
+            if(frame.memo_recording) {
+                memo->end(current_time, memory.manager(), execution);
+            }
+            frames.pop_back();
+            if(!frames.empty()) {
+                memory.release(frames.back().release_partition);
+                frames.back().release_partition = -1;
+            }
+            continue;
+        }
+
+        size_t i = frame.ip++;
+        size_t at = frame.block->locate(i, frame.span);
+        const instruction& ins = frame.trace->code[at];
+        const PCB& current = frame.current;
+        int duration_intr = ins.operand;
+
+        if(ins.op == opcode::CPU) { //As per Assignment 1
+            STATS_COUNT(CPU);
+            simulate_cpu(duration_intr, current_time, execution);
+        } else if(ins.op == opcode::SYSCALL) { //As per Assignment 1
+            STATS_COUNT(SYSCALL);
+            current_time = intr_boilerplate(current_time, duration_intr, context.timing.context_save, execution);
+
+            execution.emit(current_time, delays[duration_intr], event_kind::SYSCALL_ISR);
+            current_time += delays[duration_intr];
+
+            execute_iret(current_time, execution);
+        } else if(ins.op == opcode::END_IO) {
+            STATS_COUNT(END_IO);
+            current_time = intr_boilerplate(current_time, duration_intr, context.timing.context_save, execution);
+
+            execution.emit(current_time, delays[duration_intr], event_kind::ENDIO_ISR);
+            current_time += delays[duration_intr];
+
+            execute_iret(current_time, execution);
+        } else if(ins.op == opcode::FORK) {
+            STATS_COUNT(FORK);
+            current_time = intr_boilerplate(current_time, 2, context.timing.context_save, execution);
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+            //FORK implementation
+            
+            // Calculate next PID inline (the queue keeps its largest PID, so this is O(1))
+            unsigned int child_pid = 1;
+            if (!frame.waiting.empty() && frame.waiting.max_pid() >= child_pid) child_pid = frame.waiting.max_pid() + 1;
+            if (current.PID >= child_pid) child_pid = current.PID + 1;
+            
+            // Find available partition using BEST FIT algorithm
+            int child_partition = find_partition(memory, current.size);
+
+            // Declare child PCB outside if block so it's accessible later
+            PCB child(child_pid, current.PID, current.program, current.size, child_partition);
+
+            if(child_partition == -1) {
+                STATS_COUNT(FORK_ERROR);
+                execution.emit(current_time, 0, event_kind::FORK_ERROR);
+            } else {
+                execution.emit(current_time, duration_intr, event_kind::CLONE_PCB);
+                memory.occupy(child_partition, child_pid, current.size);
+                current_time += duration_intr;
+
+                execution.emit(current_time, 0, event_kind::SCHEDULER);
+                execute_iret(current_time, execution);
+
+                ///////////////////////////////////////////////////////////////////////////////////////////
+                //SYSTEM STATUS for FORK (ADD STEPS HERE)
+                
+                // Waiting processes: parent first, then the wait queue (shared, not copied)
+                execution.snapshot(current_time, opcode::FORK, duration_intr, 
+                                   child, &current, frame.waiting);
+                
+                ///////////////////////////////////////////////////////////////////////////////////////////
+            }           
+            ///////////////////////////////////////////////////////////////////////////////////////////
+
+            //The fork table (built by compile_trace) gives 2 things:
+            // * The block holding the trace of the child (and only the child, skip parent)
+            // * The index of where the parent is supposed to start executing from
+            const fork_entry& fork = frame.block->fork_at(at);
+            frame.ip = fork.parent_index + 1;
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+            //With the child's trace, run the child: it goes on top of the parent's frame
+
+            if(child_partition != -1 && fork.child_block != -1) {
+                // Create child_wait_queue with parent added; it shares the parent's queue
+                wait_queue child_wait_queue = frame.waiting.push(current);
+
+                frame.release_partition = child_partition;
+                const compiled_trace* child_trace = frame.trace;
+                frames.push_back(process_frame{child_trace, &child_trace->blocks[fork.child_block], 0, 0,
+                                               child, std::move(child_wait_queue), -1});
+            }
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+
+        } else if(ins.op == opcode::EXEC) {
+            STATS_COUNT(EXEC);
+            int program_id = ins.program;
+
+            current_time = intr_boilerplate(current_time, 3, context.timing.context_save, execution);
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+            //EXEC implementation
+
+            // Get program size from the registry (unknown programs have id -1)
+            unsigned int exec_size = program_id == -1 ? 0 : context.external_files[program_id].size;
+
+            // Find available partition using BEST FIT algorithm - DECLARE OUTSIDE IF BLOCK
+            int avail_exec_partition = find_partition(memory, exec_size);
+
+            if (exec_size == 0) {
+                STATS_COUNT(EXEC_ERROR);
+                execution.emit(current_time, 0, event_kind::EXEC_NOT_FOUND);
+            } else if (avail_exec_partition == -1) {
+                STATS_COUNT(EXEC_ERROR);
+                execution.emit(current_time, 0, event_kind::EXEC_NO_PARTITION);
+            } else {
+                STATS_COUNT(PROGRAM_LOAD);
+                execution.emit(current_time, duration_intr, event_kind::PROGRAM_SIZE, exec_size);
+                current_time += duration_intr;
+
+                execution.emit(current_time, exec_size * 15, event_kind::LOAD_PROGRAM);
+                current_time += (exec_size * 15);
+
+                execution.emit(current_time, 3, event_kind::MARK_PARTITION);
+                current_time += 3;
+
+                execution.emit(current_time, 6, event_kind::UPDATE_PCB);
+                current_time += 6;
+
+                // Free old partition and mark new partition
+                memory.release(current.partition_number);
+                memory.occupy(avail_exec_partition, current.PID, exec_size);
+
+                execution.emit(current_time, 0, event_kind::SCHEDULER);
+                execute_iret(current_time, execution);
+
+                ///////////////////////////////////////////////////////////////////////////////////////////
+                
+                
+                // Create exec'd PCB with new program name and size
+                PCB exec_running_pcb(current.PID, current.PPID, context.external_files[program_id].program, exec_size, avail_exec_partition);
+                
+                // Use helper function to append system status
+                execution.snapshot(current_time, opcode::EXEC, duration_intr, 
+                                   exec_running_pcb, nullptr, frame.waiting);
+                
+                ///////////////////////////////////////////////////////////////////////////////////////////
+
+            }
+
+            //Nothing after an EXEC runs in this process (why this is important is answered in the report)
+            frame.ip = frame.block->size();
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+            //With the exec's trace (i.e. trace of external program), run the exec on top of this frame
+
+            if(exec_size != 0 && avail_exec_partition != -1) {
+                //The image was loaded and compiled at startup; a missing file runs as an empty trace
+                const compiled_trace* exec_traces = context.programs.find(program_id);
+
+                PCB exec_pcb(current.PID, current.PPID, context.external_files[program_id].program, exec_size, avail_exec_partition);
+                
+                // Create exec_wait_queue without current process
+                wait_queue exec_wait_queue = frame.waiting.without(current.PID);
+                
+                const exec_memo::entry* recorded = nullptr;
+                if(exec_traces != nullptr && memo != nullptr) {
+                    recorded = memo->find(program_id, exec_pcb, exec_wait_queue, memory.manager());
+                }
+
+                if(recorded != nullptr) {
+                    //Same program from the same state: replay it, then free its partition as a return would
+                    current_time = memo->replay(*recorded, current_time, memory.manager(), execution);
+                    memory.release(avail_exec_partition);
+                } else if(exec_traces != nullptr) {
+                    frame.release_partition = avail_exec_partition;
+                    frames.push_back(process_frame{exec_traces, &exec_traces->blocks[0], 0, 0,
+                                                   exec_pcb, std::move(exec_wait_queue), -1, false});
+                    if(memo != nullptr) {
+                        frames.back().memo_recording = memo->begin(current_time, memory.manager(), execution);
+                    }
+                } else {
+                    memory.release(avail_exec_partition);
+                }
+            }
+
+            ///////////////////////////////////////////////////////////////////////////////////////////
+        }
+    }
+
+    return current_time;
+}
+
+//Runs simulate_trace_on() with the allocator memory holds, resolved once for the whole run
+int simulate_trace(const simulation_context& context, const compiled_trace& trace, int time, PCB init, wait_queue init_wait_queue,
+                   partition_manager& memory, event_buffer& execution, std::vector<process_frame>& frames,
+                   exec_memo* memo = nullptr) {
+    return memory.with_table([&](auto& resolved) {
+        return simulate_trace_on(context, trace, time, std::move(init), std::move(init_wait_queue), resolved, execution, frames, memo);
+    });
+}
+
+int simulate_trace(const simulation_context& context, const compiled_trace& trace, int time, PCB init, wait_queue init_wait_queue,
+                   partition_manager& memory, event_buffer& execution) {
+    std::vector<process_frame> frames;
+    return simulate_trace(context, trace, time, std::move(init), std::move(init_wait_queue), memory, execution, frames);
+}
+
+/*
+    Embeddable simulator. The configuration (vector table, device table and the
+    compiled program images) is immutable once loaded and can be shared by any
+    number of simulators. Each simulator owns its partition table, output sinks
+    and scratch buffers, which are kept between runs.
+
+    Output is captured in memory unless open_output() or open_binary_output()
+    is called. Errors are thrown as simulator_error.
+*/
+class Simulator {
+public:
+    //What a single run produced
+    struct run_result {
+        int     end_time = 0;
+        size_t  events = 0;
+        size_t  execution_bytes = 0;
+        size_t  status_bytes = 0;
+    };
+
+    Simulator() : config(std::make_shared<const simulation_context>()) {}
+
+    explicit Simulator(std::shared_ptr<const simulation_context> _config) : config(std::move(_config)) {}
+
+    //Reads the tables and compiles every program in external_files; call it before opening outputs
+    void load_config(const std::string& vector_table, const std::string& device_table,
+                     const std::string& external_files, const interrupt_timing& timing = interrupt_timing(),
+                     std::ostream& warnings = std::cerr) {
+        auto context = std::make_shared<simulation_context>();
+        context->timing = timing;
+        context->vectors = load_vector_table(vector_table);
+        context->delays = load_device_table(device_table);
+        context->external_files = load_external_files(external_files, warnings);
+        context->programs.load(context->external_files, context->tables());
+        config = std::move(context);
+        events.attach(null_writer());
+        writer.reset();
+        memo.clear();
+    }
+
+    const simulation_context& context() const {
+        return *config;
+    }
+
+    //The configuration, for other simulators to share
+    std::shared_ptr<const simulation_context> shared_context() const {
+        return config;
+    }
+
+    //Partition sizes in Mb; an empty list means the default layout. Only the fixed memory mode uses them.
+    void set_partition_layout(const std::vector<unsigned int>& sizes) {
+        std::vector<unsigned int> next = sizes.empty() ? partition_manager::default_layout() : sizes;
+        if(next != layout) {
+            layout = std::move(next);
+            if(memory.mode() == memory_mode::FIXED) {
+                memory.configure(layout);
+            }
+            memo.clear();
+        }
+    }
+
+    //Fixed partitions (the layout above, the default) or a dynamic allocator over total Mb
+    void set_memory_mode(memory_mode mode, unsigned int total) {
+        if(mode == memory_mode::FIXED) {
+            memory.configure(layout);
+        } else {
+            memory.configure(mode, total);
+        }
+        memo.clear();
+    }
+
+    //Placement policy of the fixed partition table (best fit by default); the table is emptied
+    void set_placement(placement_policy policy) {
+        memory.configure(policy);
+        memo.clear();
+    }
+
+    void load_partitions(const std::string& path) {
+        set_partition_layout(load_partition_layout(path));
+    }
+
+    //Text output to files ("-" for stdout); files stay open until the output changes
+    void open_output(const std::string& execution_path, const std::string& status_path) {
+        std::unique_ptr<output_sink> execution = open_sink(execution_path);
+        std::unique_ptr<output_sink> status = open_sink(status_path);
+        set_sinks(std::move(execution), std::move(status), false);
+    }
+
+    //A single binary event log instead of the text files
+    void open_binary_output(const std::string& path) {
+        set_sinks(open_sink(path), nullptr, true);
+    }
+
+    //Back to in-memory output (the default)
+    void capture_output() {
+        set_sinks(nullptr, nullptr, false);
+    }
+
+    //Captured output of the runs since the last reset
+    const std::string& execution_output() {
+        return captured_execution.str();
+    }
+
+    const std::string& status_output() {
+        return captured_status.str();
+    }
+
+    //Runs a trace file from time 0 on an empty partition table
+    run_result run(const std::string& trace_path) {
+        mapped_file trace(trace_path);
+        return run(trace);
+    }
+
+    //Runs a trace file that is already open, compiling it straight from the mapped text
+    run_result run(const mapped_file& trace) {
+        stats_scope scope(collecting ? &statistics : active_stats);
+        return run_compiled(compile_trace(trace.text(), config->external_files, config->tables(), trace.path()));
+    }
+
+    //Runs a trace given as its text; source names it in error messages
+    run_result run_text(std::string_view text, const std::string& source) {
+        stats_scope scope(collecting ? &statistics : active_stats);
+        return run_compiled(compile_trace(text, config->external_files, config->tables(), source));
+    }
+
+    //Runs a trace given as its lines
+    run_result run_lines(const std::vector<std::string>& lines) {
+        stats_scope scope(collecting ? &statistics : active_stats);
+        return run_compiled(compile_trace(lines, config->external_files, config->tables()));
+    }
+
+    //Which system status tables a text run writes: every one (-1, the default) or the one in effect at time
+    void set_status_time(int time) {
+        status_time = time;
+    }
+
+    //Snapshots of the last text run, kept as deltas
+    const status_history& status_snapshots() const {
+        return history;
+    }
+
+    //Empties the partition table, the captured output, the stats and the analytics, and drops whatever a failed
+    //run left pending in the event buffer or the memo; buffers keep their memory
+    void reset() {
+        events.discard();
+        memo.abort();
+        memory.release_all();
+        captured_execution.clear();
+        captured_status.clear();
+        statistics = run_stats();
+        analysis = run_analytics();
+    }
+
+    //Collects run statistics (see --stats) for the following runs
+    void collect_stats(bool enable) {
+        collecting = enable;
+    }
+
+    //Replays EXECs that start from a state seen before (see exec_memo); the memo is kept across runs
+    void memoize_exec(bool enable) {
+        memoizing = enable;
+    }
+
+    //Keeps utilisation and fragmentation analytics (see --analytics) for the following runs
+    void collect_analytics(bool enable) {
+        analysing = enable;
+    }
+
+    //Stats of the runs since the last reset
+    const run_stats& stats() const {
+        return statistics;
+    }
+
+    //Analytics of the runs since the last reset
+    const run_analytics& analytics() const {
+        return analysis;
+    }
+
+private:
+    std::shared_ptr<const simulation_context> config;
+    std::vector<unsigned int> layout = partition_manager::default_layout();
+    partition_manager memory;
+
+    string_sink captured_execution;
+    string_sink captured_status;
+    std::unique_ptr<output_sink> owned_execution;
+    std::unique_ptr<output_sink> owned_status;
+    output_sink* execution_sink = &captured_execution;
+    output_sink* status_sink = &captured_status;    //nullptr for binary output
+    bool binary = false;
+
+    std::unique_ptr<event_formatter> formatter;
+    std::unique_ptr<event_writer> writer;
+    event_buffer events{null_writer()};
+
+    std::vector<process_frame> frames;
+    exec_memo memo;
+    bool memoizing = false;
+
+    bool collecting = false;
+    run_stats statistics;
+
+    bool analysing = false;
+    run_analytics analysis;
+
+    status_history history;
+    int status_time = -1;
+
+    //Runs a compiled trace from time 0 on an empty partition table
+    run_result run_compiled(const compiled_trace& compiled) {
+        analytics_scope scope(analysing ? &analysis : active_analytics);
+        memory.release_all();
+        history.clear();
+        if(active_analytics != nullptr) {
+            active_analytics->start_run(memory);
+        }
+        PCB init(0, -1, intern("init"), 1, -1);
+        if(!allocate_memory(&init, memory)) {
+            throw simulator_error("Memory allocation failed for init");
+        }
+
+        //A binary log header written by a new writer counts towards this run
+        size_t events_before = events.size();
+        size_t execution_before = execution_sink->bytes_written();
+        size_t status_before = status_sink ? status_sink->bytes_written() : 0;
+        if(!writer) {
+            build_writer();
+        }
+
+        //A replay only restores the partition table it ended with, so the memo sits out runs with analytics
+        //and runs on dynamic memory, whose blocks it cannot fingerprint, or under next fit, whose cursor it does not record
+        bool replayable = memoizing && active_analytics == nullptr && memory.mode() == memory_mode::FIXED
+                          && memory.placement() != placement_policy::NEXT_FIT;
+        run_result result;
+        result.end_time = simulate_trace(*config, compiled, 0, init, wait_queue(), memory, events, frames,
+                                         replayable ? &memo : nullptr);
+        if(active_analytics != nullptr) {
+            active_analytics->end_run(result.end_time);
+        }
+        events.flush();
+        render_status();
+
+        result.events = events.size() - events_before;
+        result.execution_bytes = execution_sink->bytes_written() - execution_before;
+        result.status_bytes = status_sink ? status_sink->bytes_written() - status_before : 0;
+        return result;
+    }
+
+    //Writes the status tables recorded by a text run, then keeps the history until the next run
+    void render_status() {
+        if(binary) {
+            return;
+        }
+        STATS_TIMER(OUTPUT);
+        if(status_time < 0) {
+            history.render_all(*status_sink);
+        } else {
+            history.render_at(status_time, *status_sink);
+        }
+        status_sink->flush();
+    }
+
+    //Placeholder target for the event buffer until the first run builds the real writer
+    static event_writer& null_writer() {
+        struct discard_writer : event_writer {
+            void write_events(const event*, size_t) override {}
+            void write_snapshot(int, opcode, int, const PCB&, const PCB*, const wait_queue&) override {}
+            void flush() override {}
+        };
+        static discard_writer discard;
+        return discard;
+    }
+
+    void set_sinks(std::unique_ptr<output_sink> execution, std::unique_ptr<output_sink> status, bool _binary) {
+        events.flush();
+        events.attach(null_writer());
+        writer.reset();
+
+        owned_execution = std::move(execution);
+        owned_status = std::move(status);
+        execution_sink = owned_execution ? owned_execution.get() : &captured_execution;
+        status_sink = _binary ? nullptr : owned_status ? owned_status.get() : &captured_status;
+        binary = _binary;
+    }
+
+    void build_writer() {
+        if(binary) {
+            std::vector<symbol> programs = {intern("init")};
+            for(const auto& file : config->external_files.files()) {
+                programs.push_back(file.program);
+            }
+            writer = std::make_unique<binary_event_writer>(*execution_sink, config->vectors, programs);
+        } else {
+            formatter = std::make_unique<event_formatter>(config->vectors);
+            writer = std::make_unique<text_event_writer>(*formatter, *execution_sink, history);
+        }
+        events.attach(*writer);
+    }
+};
+
+#endif
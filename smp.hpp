@@ -0,0 +1,579 @@
+/**
+ *
+ * @file smp.hpp
+ * @brief SMP mode: several simulated CPUs with their own run queues, least-loaded placement and work stealing
+ *
+ */
+
+#ifndef SMP_HPP_
+#define SMP_HPP_
+
+#include "simulator.hpp"
+#include <cassert>
+#include <climits>
+#include <deque>
+#include <filesystem>
+#include <optional>
+
+//CPU time of the ISR that starts a device or takes its completion when I/O is asynchronous
+#define DEVICE_ISR_TIME 1
+
+//A process in SMP mode: its PCB, where it is in its trace and when it became runnable
+struct smp_process {
+    PCB                     pcb;
+    const compiled_trace*   trace;
+    const trace_block*      block;
+    size_t                  ip;
+    size_t                  span;       //cursor for block->locate()
+    int                     ready_time;
+};
+
+//One simulated CPU. It runs its current process to the end, then takes the next one from its queue.
+struct smp_core {
+    int                         clock = 0;
+    int                         busy = 0;           //time spent running processes (not idle)
+    std::optional<smp_process>  running;
+    std::deque<smp_process>     queue;
+    size_t                      dispatched = 0;     //processes started, stolen ones included
+    size_t                      steals = 0;         //processes taken from another core's queue
+    event_buffer*               log;
+
+    //Processes on this core: the running one and the queued ones
+    size_t load() const {
+        return (running ? 1 : 0) + queue.size();
+    }
+};
+
+//A process blocked on a device until done; its END_IO interrupt goes to the core that started the I/O
+struct smp_io {
+    smp_process     process;
+    size_t          core;
+    int             device;
+    int             start;      //when the SYSCALL blocked the process
+    int             done;       //when the device finishes, after any operations queued before it
+
+    //Orders the heap of pending I/O by completion time
+    bool operator<(const smp_io& other) const {
+        return done > other.done;
+    }
+};
+
+//What an SMP run produced, per core and overall
+struct smp_result {
+    int                     end_time = 0;   //makespan: when the last core finished
+    std::vector<int>        busy;
+    std::vector<size_t>     dispatched;
+    std::vector<size_t>     steals;
+    size_t                  io_operations = 0;  //completed device operations (async I/O only)
+    long                    io_busy = 0;        //sum of the time devices were busy
+    long                    io_wait = 0;        //sum of the time processes were blocked on I/O
+};
+
+//The process table the status tables show: each core's running process and queue, and the processes blocked on I/O
+struct smp_table {
+    struct core_rows {
+        std::optional<PCB>  running;
+        std::deque<PCB>     queue;
+    };
+
+    std::vector<core_rows>              cores;
+    std::vector<std::pair<size_t, PCB>> blocked;    //core that started the I/O and the process, in the order they blocked
+};
+
+/*
+    A change to the process table, stamped with the time it happens. A core
+    acts one whole instruction at a time, so changes are made out of time
+    order across cores. They are queued and applied to the table in (time,
+    sequence) order; a SNAPSHOT writes the table as it stands at its time.
+    Processes are named by PID, since two cores can add to a queue in one
+    order and take from it in another.
+*/
+struct smp_change {
+    enum class kind : uint8_t {
+        QUEUE,      //pcb joins the back of core's queue
+        DISPATCH,   //pcb leaves from's queue and runs on core
+        EXEC,       //core's running process becomes pcb
+        END,        //core's running process exits
+        BLOCK,      //core's running process waits on a device
+        UNBLOCK,    //pcb's I/O is done and it joins the back of core's queue
+        SNAPSHOT    //write the table: trace_type and duration go in its title
+    };
+
+    int     time;
+    size_t  sequence;
+    kind    what;
+    size_t  core;
+    size_t  from;
+    PCB     pcb;
+    opcode  trace_type;
+    int     duration;
+
+    //Orders the heap of changes: earliest, then oldest, on top
+    bool operator<(const smp_change& other) const {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+//Applies a change other than SNAPSHOT
+void apply_smp_change(smp_table& table, const smp_change& change) {
+    auto take = [](std::deque<PCB>& queue, unsigned int pid) {
+        auto it = std::find_if(queue.begin(), queue.end(), [pid](const PCB& pcb) { return pcb.PID == pid; });
+        PCB pcb = *it;
+        queue.erase(it);
+        return pcb;
+    };
+
+    smp_table::core_rows& core = table.cores[change.core];
+    switch(change.what) {
+        case smp_change::kind::QUEUE:
+            core.queue.push_back(change.pcb);
+            break;
+        case smp_change::kind::DISPATCH:
+            core.running = take(table.cores[change.from].queue, change.pcb.PID);
+            break;
+        case smp_change::kind::EXEC:
+            core.running = change.pcb;
+            break;
+        case smp_change::kind::END:
+            core.running.reset();
+            break;
+        case smp_change::kind::BLOCK:
+            table.blocked.emplace_back(change.core, *core.running);
+            core.running.reset();
+            break;
+        case smp_change::kind::UNBLOCK: {
+            auto it = std::find_if(table.blocked.begin(), table.blocked.end(),
+                                   [&](const std::pair<size_t, PCB>& io) { return io.second.PID == change.pcb.PID; });
+            core.queue.push_back(it->second);
+            table.blocked.erase(it);
+            break;
+        }
+        case smp_change::kind::SNAPSHOT:
+            break;
+    }
+}
+
+//Writes a system status table with a core column: each core's running process, then its queue, then the processes blocked on I/O
+void append_smp_status(output_sink& system_status, int current_time, const char* trace_type, int duration,
+                       const smp_table& table) {
+    write_text(system_status, "time: ");
+    write_int(system_status, current_time);
+    write_text(system_status, "; current trace: ");
+    write_text(system_status, trace_type);
+    write_text(system_status, ", ");
+    write_int(system_status, duration);
+    write_text(system_status, "\n");
+    write_text(system_status, "+-------------------------------------------------------------+\n");
+    write_text(system_status, "| core | PID |program name |partition number | size |   state |\n");
+    write_text(system_status, "+-------------------------------------------------------------+\n");
+
+    auto row = [&](size_t core, const PCB& pcb, const char* state) {
+        write_text(system_status, "|    ");
+        write_int(system_status, core);
+        write_text(system_status, " ");
+        append_pcb_row(system_status, pcb, state);
+    };
+    for(size_t k = 0; k < table.cores.size(); k++) {
+        if(table.cores[k].running) {
+            row(k, *table.cores[k].running, "running");
+        }
+        for(const auto& pcb : table.cores[k].queue) {
+            row(k, pcb, "waiting");
+        }
+    }
+    for(const auto& [core, pcb] : table.blocked) {
+        row(core, pcb, "blocked");
+    }
+
+    write_text(system_status, "+-------------------------------------------------------------+\n\n");
+}
+
+/*
+    Runs a compiled trace on an SMP machine with one core per log. init starts
+    on core 0. A FORK puts the child on the least-loaded core (running plus
+    queued processes, lowest core number on a tie) and the parent carries on
+    after its IF_PARENT section, so parent and child run at the same time
+    instead of the parent waiting. An EXEC replaces the process image in place.
+
+    Processes are not preempted. A core whose process ends dispatches the
+    front of its own queue; when that is empty it steals from the back of the
+    longest queue. The core that acts next is the one whose next instruction
+    starts first, and never before the last action started (a process that
+    becomes the back of the longest queue later is not stolen in the past).
+    It runs that whole instruction in one step: the
+    partitions a FORK or EXEC takes or frees, and the queue it puts a child
+    on, are already changed when another core acts, even if that core's
+    action starts before the FORK or EXEC finishes. Each core writes its own
+    execution log. Status tables are stamped when their FORK or EXEC
+    completes (after its IRET). Every change to the process table is kept
+    with its own time (see smp_change) and a table is only written once no
+    core can act before its stamp, so it shows every core as of that time.
+
+    With async_io, devices work in the background. A SYSCALL starts its device
+    and blocks the process, freeing the core for other ready processes. Each
+    device runs one operation at a time, in the order they were started, and
+    takes its device table delay for each. When the operation finishes, an
+    END_IO interrupt is taken by the core that started it, at its next
+    instruction boundary, and the process goes back on that core's queue.
+    END_IO lines in the trace are skipped, since the completion is now
+    generated by the device.
+
+    Like simulate_trace_on(), the loop is instantiated once per allocator.
+*/
+template<typename Memory>
+smp_result simulate_smp_on(const simulation_context& context, const compiled_trace& trace, Memory& memory,
+                           const std::vector<event_buffer*>& logs, output_sink& system_status, bool async_io) {
+
+    STATS_TIMER(SIMULATION);
+    const std::vector<int>& delays = context.delays;
+    std::vector<smp_core> cores(logs.size());
+    for(size_t k = 0; k < cores.size(); k++) {
+        cores[k].log = logs[k];
+    }
+
+    PCB init(0, -1, intern("init"), 1, -1);
+    if(!allocate_memory(&init, memory.manager())) {
+        throw simulator_error("Memory allocation failed for init");
+    }
+    cores[0].queue.push_back(smp_process{init, &trace, &trace.blocks[0], 0, 0, 0});
+    unsigned int next_pid = 1;
+    int now = 0;    //when the last action started; none starts earlier, whatever was queued since
+
+    std::vector<smp_io> pending;                        //heap, earliest completion on top
+    std::vector<int> device_free(delays.size(), 0);     //when each device is done with its queued operations
+    smp_result result;
+
+    //The process table as of the changes applied so far, and the changes not applied yet
+    smp_table table;
+    table.cores.resize(cores.size());
+    std::vector<smp_change> changes;    //heap, earliest (then oldest) on top
+    size_t sequence = 0;
+
+    auto change = [&](int time, smp_change::kind what, size_t core, const PCB& pcb, size_t from = 0) {
+        changes.push_back(smp_change{time, sequence++, what, core, from, pcb, opcode::INVALID, 0});
+        std::push_heap(changes.begin(), changes.end());
+    };
+
+    auto snapshot = [&](int time, opcode trace_type, int duration) {
+        STATS_COUNT(SNAPSHOT);
+        changes.push_back(smp_change{time, sequence++, smp_change::kind::SNAPSHOT, 0, 0, init, trace_type, duration});
+        std::push_heap(changes.begin(), changes.end());
+    };
+
+    //Applies the changes made at or before time, writing the tables among them
+    auto release_statuses = [&](int time) {
+        STATS_TIMER(OUTPUT);
+        while(!changes.empty() && changes.front().time <= time) {
+            std::pop_heap(changes.begin(), changes.end());
+            const smp_change& next = changes.back();
+            if(next.what == smp_change::kind::SNAPSHOT) {
+                append_smp_status(system_status, next.time, opcode_name(next.trace_type), next.duration, table);
+            } else {
+                apply_smp_change(table, next);
+            }
+            changes.pop_back();
+        }
+    };
+
+    change(0, smp_change::kind::QUEUE, 0, init);
+
+    while(true) {
+        //Pick the core that acts first: a running core at its clock, an idle one when its next process is ready
+        //An idle core with nothing queued steals from the longest queue (the lowest numbered one on a tie)
+        smp_core* longest = nullptr;
+        for(auto& other : cores) {
+            if(!other.queue.empty() && (longest == nullptr || other.queue.size() > longest->queue.size())) {
+                longest = &other;
+            }
+        }
+
+        smp_core* core = nullptr;
+        smp_core* victim = nullptr;
+        int start = 0;
+        for(auto& candidate : cores) {
+            smp_core* source = &candidate;
+            if(!candidate.running && candidate.queue.empty()) {
+                source = longest;
+                if(source == nullptr) {
+                    continue;
+                }
+            }
+            int ready = candidate.running ? candidate.clock
+                      : std::max({now, candidate.clock, source == &candidate ? source->queue.front().ready_time
+                                                                             : source->queue.back().ready_time});
+            if(core == nullptr || ready < start) {
+                core = &candidate;
+                victim = source;
+                start = ready;
+            }
+        }
+
+        //Every table still to come is stamped after the next action starts, so the ones up to then can go out
+        int next_action = core != nullptr ? start : INT_MAX;
+        for(const smp_io& io : pending) {
+            next_action = std::min(next_action, std::max({now, cores[io.core].clock, io.done}));
+        }
+        release_statuses(next_action);
+
+        //A finished device interrupts the core that started it, ahead of anything it would do at the same time
+        if(!pending.empty()) {
+            smp_core& target = cores[pending.front().core];
+            int at = std::max({now, target.clock, pending.front().done});
+            if(core == nullptr || at <= start) {
+                now = at;
+                std::pop_heap(pending.begin(), pending.end());
+                smp_io io = std::move(pending.back());
+                pending.pop_back();
+
+                event_buffer& execution = *target.log;
+                if(at > target.clock) {
+                    execution.emit(target.clock, at - target.clock, event_kind::IDLE);
+                }
+                int current_time = intr_boilerplate(at, io.device, context.timing.context_save, execution);
+                execution.emit(current_time, DEVICE_ISR_TIME, event_kind::IO_DONE, io.process.pcb.PID);
+                current_time += DEVICE_ISR_TIME;
+                execution.emit(current_time, context.timing.context_restore, event_kind::EPILOGUE);
+                current_time += context.timing.context_restore + 2;
+
+                target.busy += current_time - at;
+                target.clock = current_time;
+                result.io_operations++;
+                result.io_wait += at - io.start;
+                io.process.ready_time = current_time;
+                change(current_time, smp_change::kind::UNBLOCK, io.core, io.process.pcb);
+                target.queue.push_back(std::move(io.process));
+                continue;
+            }
+        }
+        if(core == nullptr) {
+            break;
+        }
+        now = start;
+
+        event_buffer& execution = *core->log;
+
+        //Idle core: wait for the process to be ready, then start it
+        if(!core->running) {
+            if(start > core->clock) {
+                execution.emit(core->clock, start - core->clock, event_kind::IDLE);
+                core->clock = start;
+            }
+            change(core->clock, smp_change::kind::DISPATCH, core - cores.data(),
+                   victim == core ? core->queue.front().pcb : victim->queue.back().pcb, victim - cores.data());
+            if(victim == core) {
+                core->running = std::move(core->queue.front());
+                core->queue.pop_front();
+                execution.emit(core->clock, 0, event_kind::DISPATCH, core->running->pcb.PID);
+            } else {
+                core->running = std::move(victim->queue.back());
+                victim->queue.pop_back();
+                core->steals++;
+                execution.emit(core->clock, 0, event_kind::STEAL, core->running->pcb.PID);
+            }
+            core->dispatched++;
+            continue;
+        }
+
+        smp_process& process = *core->running;
+        const PCB& current = process.pcb;
+
+        //The process is done: its partition is freed and the core is idle again
+        if(process.ip >= process.block->size()) {
+            memory.release(current.partition_number);
+            change(core->clock, smp_change::kind::END, core - cores.data(), current);
+            core->running.reset();
+            continue;
+        }
+
+        int current_time = core->clock;
+        size_t at = process.block->locate(process.ip++, process.span);
+        const instruction& ins = process.trace->code[at];
+        int duration_intr = ins.operand;
+
+        //compile_line has already checked interrupt numbers against these tables
+        assert(!(ins.op == opcode::SYSCALL || ins.op == opcode::END_IO)
+               || (duration_intr >= 0 && static_cast<size_t>(duration_intr) < std::min(delays.size(), context.vectors.size())));
+
+        if(ins.op == opcode::CPU) {
+            STATS_COUNT(CPU);
+            simulate_cpu(duration_intr, current_time, execution);
+        } else if(async_io && ins.op == opcode::SYSCALL) {
+            //Start the device, then give the core up until the END_IO interrupt
+            STATS_COUNT(SYSCALL);
+            current_time = intr_boilerplate(current_time, duration_intr, context.timing.context_save, execution);
+            execution.emit(current_time, DEVICE_ISR_TIME, event_kind::IO_START, current.PID);
+            current_time += DEVICE_ISR_TIME;
+            execution.emit(current_time, context.timing.context_restore, event_kind::EPILOGUE);
+            current_time += context.timing.context_restore + 2;
+
+            int& free_at = device_free[duration_intr];
+            free_at = std::max(free_at, current_time) + delays[duration_intr];
+            result.io_busy += delays[duration_intr];
+            change(current_time, smp_change::kind::BLOCK, core - cores.data(), current);
+            pending.push_back(smp_io{std::move(process), static_cast<size_t>(core - cores.data()), duration_intr,
+                                     current_time, free_at});
+            std::push_heap(pending.begin(), pending.end());
+            core->running.reset();
+        } else if(async_io && ins.op == opcode::END_IO) {
+            //The device raises this interrupt itself
+            STATS_COUNT(END_IO);
+        } else if(ins.op == opcode::SYSCALL || ins.op == opcode::END_IO) {
+            if(ins.op == opcode::SYSCALL) {
+                STATS_COUNT(SYSCALL);
+            } else {
+                STATS_COUNT(END_IO);
+            }
+            current_time = intr_boilerplate(current_time, duration_intr, context.timing.context_save, execution);
+
+            execution.emit(current_time, delays[duration_intr],
+                           ins.op == opcode::SYSCALL ? event_kind::SYSCALL_ISR : event_kind::ENDIO_ISR);
+            current_time += delays[duration_intr];
+
+            execute_iret(current_time, execution);
+        } else if(ins.op == opcode::FORK) {
+            STATS_COUNT(FORK);
+            current_time = intr_boilerplate(current_time, 2, context.timing.context_save, execution);
+
+            //PIDs are unique across the machine, so they come from one counter
+            int child_partition = find_partition(memory, current.size);
+            const fork_entry& fork = process.block->fork_at(at);
+            process.ip = fork.parent_index + 1;
+
+            if(child_partition == -1) {
+                STATS_COUNT(FORK_ERROR);
+                execution.emit(current_time, 0, event_kind::FORK_ERROR);
+            } else {
+                unsigned int child_pid = next_pid++;
+                PCB child(child_pid, current.PID, current.program, current.size, child_partition);
+                execution.emit(current_time, duration_intr, event_kind::CLONE_PCB);
+                memory.occupy(child_partition, child_pid, current.size);
+                current_time += duration_intr;
+
+                execution.emit(current_time, 0, event_kind::SCHEDULER);
+                execute_iret(current_time, execution);
+
+                if(fork.child_block == -1) {
+                    //Nothing for the child to run: it exits straight away
+                    memory.release(child_partition);
+                } else {
+                    smp_core* target = &cores[0];
+                    for(auto& candidate : cores) {
+                        if(candidate.load() < target->load()) {
+                            target = &candidate;
+                        }
+                    }
+                    change(current_time, smp_change::kind::QUEUE, target - cores.data(), child);
+                    target->queue.push_back(smp_process{child, process.trace, &process.trace->blocks[fork.child_block],
+                                                        0, 0, current_time});
+                }
+                snapshot(current_time, opcode::FORK, duration_intr);
+            }
+        } else if(ins.op == opcode::EXEC) {
+            STATS_COUNT(EXEC);
+            int program_id = ins.program;
+
+            current_time = intr_boilerplate(current_time, 3, context.timing.context_save, execution);
+
+            unsigned int exec_size = program_id == -1 ? 0 : context.external_files[program_id].size;
+            int avail_exec_partition = find_partition(memory, exec_size);
+
+            //Nothing after an EXEC runs in this process
+            process.ip = process.block->size();
+
+            if(exec_size == 0) {
+                STATS_COUNT(EXEC_ERROR);
+                execution.emit(current_time, 0, event_kind::EXEC_NOT_FOUND);
+            } else if(avail_exec_partition == -1) {
+                STATS_COUNT(EXEC_ERROR);
+                execution.emit(current_time, 0, event_kind::EXEC_NO_PARTITION);
+            } else {
+                STATS_COUNT(PROGRAM_LOAD);
+                execution.emit(current_time, duration_intr, event_kind::PROGRAM_SIZE, exec_size);
+                current_time += duration_intr;
+
+                execution.emit(current_time, exec_size * 15, event_kind::LOAD_PROGRAM);
+                current_time += (exec_size * 15);
+
+                execution.emit(current_time, 3, event_kind::MARK_PARTITION);
+                current_time += 3;
+
+                execution.emit(current_time, 6, event_kind::UPDATE_PCB);
+                current_time += 6;
+
+                memory.release(current.partition_number);
+                memory.occupy(avail_exec_partition, current.PID, exec_size);
+
+                execution.emit(current_time, 0, event_kind::SCHEDULER);
+                execute_iret(current_time, execution);
+
+                //The new image runs on the same core; a missing file runs as an empty trace
+                process.pcb = PCB(current.PID, current.PPID, context.external_files[program_id].program,
+                                  exec_size, avail_exec_partition);
+                change(current_time, smp_change::kind::EXEC, core - cores.data(), process.pcb);
+                if(const compiled_trace* exec_trace = context.programs.find(program_id)) {
+                    process.trace = exec_trace;
+                    process.block = &exec_trace->blocks[0];
+                    process.ip = 0;
+                    process.span = 0;
+                }
+                snapshot(current_time, opcode::EXEC, duration_intr);
+            }
+        }
+
+        core->busy += current_time - core->clock;
+        core->clock = current_time;
+    }
+
+    for(const auto& core : cores) {
+        result.end_time = std::max(result.end_time, core.clock);
+        result.busy.push_back(core.busy);
+        result.dispatched.push_back(core.dispatched);
+        result.steals.push_back(core.steals);
+        core.log->flush();
+    }
+    release_statuses(INT_MAX);
+    system_status.flush();
+    return result;
+}
+
+//Runs simulate_smp_on() with the allocator memory holds, resolved once for the whole run
+smp_result simulate_smp(const simulation_context& context, const compiled_trace& trace, partition_manager& memory,
+                        const std::vector<event_buffer*>& logs, output_sink& system_status, bool async_io = false) {
+    return memory.with_table([&](auto& resolved) {
+        return simulate_smp_on(context, trace, resolved, logs, system_status, async_io);
+    });
+}
+
+//Execution log of one core: "out/execution.txt" becomes "out/execution_core2.txt"
+std::string smp_log_path(const std::string& execution_path, size_t core) {
+    std::filesystem::path path(execution_path);
+    std::string name = path.stem().string() + "_core" + std::to_string(core) + path.extension().string();
+    return (path.parent_path() / name).string();
+}
+
+//Per-core utilisation against the makespan
+void print_smp_result(const smp_result& result, std::ostream& out = std::cout) {
+    out << "SMP run on " << result.busy.size() << " core(s), makespan " << result.end_time << std::endl;
+    for(size_t k = 0; k < result.busy.size(); k++) {
+        double utilisation = result.end_time > 0 ? 100.0 * result.busy[k] / result.end_time : 0;
+        out << "  core " << k << ": busy " << result.busy[k] << " (" << std::fixed << std::setprecision(1)
+            << utilisation << "%), " << result.dispatched[k] << " dispatched, " << result.steals[k] << " stolen" << std::endl;
+        out.unsetf(std::ios::floatfield);
+    }
+
+    long busy = 0;
+    for(int core_busy : result.busy) {
+        busy += core_busy;
+    }
+    double span = std::max(1, result.end_time) * static_cast<double>(result.busy.size());
+    out << "  CPU utilisation: " << std::fixed << std::setprecision(1) << 100.0 * busy / span << "%" << std::endl;
+    if(result.io_operations > 0) {
+        out << "  I/O: " << result.io_operations << " operation(s), " << std::setprecision(3)
+            << 1000.0 * result.io_operations / std::max(1, result.end_time) << " per 1000 time units, devices busy "
+            << result.io_busy << ", average wait " << std::setprecision(1)
+            << static_cast<double>(result.io_wait) / result.io_operations << std::endl;
+    }
+    out.unsetf(std::ios::floatfield);
+}
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ *
+ * @file trace_generator.cpp
+ * @brief Writes a synthetic workload (trace, tables and program images) into a directory
+ *
+ */
+
+#include "workload.hpp"
+
+int main(int argc, char** argv) {
+    if(argc < 4 || argc > 5) {
+        std::cout << "ERROR!\nExpected 3 or 4 arguments, received " << argc - 1 << std::endl;
+        std::cout << "To run the program, do: ./trace_generator <scenario> <scale> <output_directory> [seed]" << std::endl;
+        std::cout << "Scenarios: cpu_stream fork_wide fork_deep exec_chain partition_exhaustion" << std::endl;
+        return 1;
+    }
+
+    unsigned int scale = 0;
+    unsigned int seed = 1;
+    try {
+        scale = std::stoul(argv[2]);
+        if(argc == 5) {
+            seed = std::stoul(argv[4]);
+        }
+    } catch(const std::exception&) {
+        std::cerr << "Error: scale and seed must be numbers" << std::endl;
+        return 1;
+    }
+
+    workload w;
+    if(!make_workload(argv[1], scale, w, seed)) {
+        std::cerr << "Error: unknown scenario " << argv[1] << std::endl;
+        return 1;
+    }
+
+    try {
+        write_workload(w, argv[3], seed);
+    } catch(const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Wrote " << w.name << " (scale " << scale << ", " << workload_lines(w) << " line(s)) to " << argv[3] << std::endl;
+    std::cout << "Run it from that directory: interrupts trace.txt vector_table.txt device_table.txt external_files.txt --partitions partitions.txt" << std::endl;
+    return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ *
+ * @file workload.hpp
+ * @brief Synthetic workloads for benchmarking: generated traces, program images and tables
+ *
+ */
+
+#ifndef WORKLOAD_HPP_
+#define WORKLOAD_HPP_
+
+#include "Interrupts_101166589_101257741.hpp"
+#include <filesystem>
+
+//A program the workload's trace can EXEC
+struct workload_program {
+    std::string                 name;
+    unsigned int                size;   //Mb
+    std::vector<std::string>    lines;
+};
+
+//Everything a simulation of a generated trace needs, written out with write_workload()
+struct workload {
+    std::string                     name;
+    unsigned int                    scale;
+    std::vector<std::string>        trace;
+    std::vector<workload_program>   programs;
+    std::vector<unsigned int>       partitions;     //empty for the default layout
+};
+
+//Same number of vectors and devices as the tables shipped with the assignment
+#define WORKLOAD_VECTORS    26
+#define WORKLOAD_DEVICES    19
+
+//A random device operation: "CPU, n", "SYSCALL, d" or "END_IO, d"
+std::string random_activity(std::mt19937& rng) {
+    switch(rng() % 3) {
+        case 0:  return "CPU, " + std::to_string(1 + rng() % 100);
+        case 1:  return "SYSCALL, " + std::to_string(rng() % WORKLOAD_DEVICES);
+        default: return "END_IO, " + std::to_string(rng() % WORKLOAD_DEVICES);
+    }
+}
+
+//scale lines of CPU bursts, system calls and I/O completions
+workload cpu_stream(unsigned int scale, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    workload w{"cpu_stream", scale, {}, {}, {}};
+    for(unsigned int k = 0; k < scale; k++) {
+        w.trace.push_back(random_activity(rng));
+    }
+    return w;
+}
+
+/*
+    scale FORKs one after the other. Each child only EXECs a short worker
+    program, so the tree is wide (one level, scale children) and every child
+    finishes before the parent forks the next one.
+*/
+workload fork_wide(unsigned int scale, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    workload w{"fork_wide", scale, {}, {}, {}};
+    w.programs.push_back(workload_program{"worker", 8, {}});
+    for(int k = 0; k < 8; k++) {
+        w.programs[0].lines.push_back(random_activity(rng));
+    }
+
+    for(unsigned int k = 0; k < scale; k++) {
+        w.trace.push_back("FORK, " + std::to_string(1 + rng() % 20));
+        w.trace.push_back("IF_CHILD, 0");
+        w.trace.push_back("EXEC worker, " + std::to_string(1 + rng() % 50));
+        w.trace.push_back("IF_PARENT, 0");
+        w.trace.push_back(random_activity(rng));
+        w.trace.push_back("ENDIF, 0");
+    }
+    return w;
+}
+
+/*
+    A binary process tree of depth scale. The trace EXECs level0; every level
+    program forks twice and each child EXECs the next level, so there are
+    2^scale leaves. (Children have to EXEC: a child that falls through to a
+    second FORK in the same trace never reaches an IF_PARENT of its own.)
+    There are enough partitions for the deepest branch, so no FORK fails.
+*/
+workload fork_deep(unsigned int scale, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    workload w{"fork_deep", scale, {}, {}, {}};
+    for(unsigned int k = 0; k <= scale; k++) {
+        workload_program program{"level" + std::to_string(k), 5, {}};
+        for(int child = 0; child < 2 && k < scale; child++) {
+            program.lines.push_back("FORK, " + std::to_string(1 + rng() % 20));
+            program.lines.push_back("IF_CHILD, 0");
+            program.lines.push_back("EXEC level" + std::to_string(k + 1) + ", " + std::to_string(1 + rng() % 50));
+            program.lines.push_back("IF_PARENT, 0");
+            program.lines.push_back(random_activity(rng));
+            program.lines.push_back("ENDIF, 0");
+        }
+        program.lines.push_back(random_activity(rng));
+        w.programs.push_back(std::move(program));
+    }
+    w.trace.push_back("EXEC level0, 10");
+    w.partitions.assign(2 * scale + 4, 10);
+    return w;
+}
+
+//The trace EXECs stage0, which EXECs stage1, and so on for scale programs
+workload exec_chain(unsigned int scale, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    workload w{"exec_chain", scale, {}, {}, {}};
+    for(unsigned int k = 0; k < scale; k++) {
+        workload_program program{"stage" + std::to_string(k), static_cast<unsigned int>(1 + rng() % 10), {}};
+        program.lines.push_back(random_activity(rng));
+        program.lines.push_back(random_activity(rng));
+        if(k + 1 < scale) {
+            program.lines.push_back("EXEC stage" + std::to_string(k + 1) + ", " + std::to_string(1 + rng() % 50));
+        }
+        w.programs.push_back(std::move(program));
+    }
+    w.trace.push_back(random_activity(rng));
+    w.trace.push_back("EXEC stage0, 10");
+    return w;
+}
+
+/*
+    scale FORKs on a machine with two partitions. The parent's FORKs take the
+    last free partition; each child then tries a FORK of its own, which finds
+    nothing free, and an EXEC of a program larger than any partition.
+*/
+workload partition_exhaustion(unsigned int scale, unsigned int seed = 1) {
+    std::mt19937 rng(seed);
+    workload w{"partition_exhaustion", scale, {}, {}, {2, 1}};
+    w.programs.push_back(workload_program{"huge", 100, {"CPU, 10"}});
+    for(unsigned int k = 0; k < scale; k++) {
+        w.trace.push_back("FORK, " + std::to_string(1 + rng() % 20));
+        w.trace.push_back("IF_CHILD, 0");
+        w.trace.push_back("FORK, " + std::to_string(1 + rng() % 20));
+        w.trace.push_back("EXEC huge, " + std::to_string(1 + rng() % 50));
+        w.trace.push_back("IF_PARENT, 0");
+        w.trace.push_back(random_activity(rng));
+        w.trace.push_back("ENDIF, 0");
+    }
+    return w;
+}
+
+//Builds a scenario by name; returns false for an unknown name
+bool make_workload(const std::string& scenario, unsigned int scale, workload& out, unsigned int seed = 1) {
+    if(scenario == "cpu_stream") {
+        out = cpu_stream(scale, seed);
+    } else if(scenario == "fork_wide") {
+        out = fork_wide(scale, seed);
+    } else if(scenario == "fork_deep") {
+        out = fork_deep(scale, seed);
+    } else if(scenario == "exec_chain") {
+        out = exec_chain(scale, seed);
+    } else if(scenario == "partition_exhaustion") {
+        out = partition_exhaustion(scale, seed);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//Number of lines in the trace and all of its program images
+size_t workload_lines(const workload& w) {
+    size_t lines = w.trace.size();
+    for(const auto& program : w.programs) {
+        lines += program.lines.size();
+    }
+    return lines;
+}
+
+void write_lines(const std::filesystem::path& path, const std::vector<std::string>& lines) {
+    std::ofstream output_file(path);
+    if(!output_file.is_open()) {
+        throw simulator_error("Unable to open output file: " + path.string());
+    }
+    for(const auto& line : lines) {
+        output_file << line << "\n";
+    }
+}
+
+/*
+    Writes a workload into dir as the simulator expects it: trace.txt,
+    vector_table.txt, device_table.txt, external_files.txt, partitions.txt
+    and one <program>.txt per program. Program images are looked up in the
+    current directory, so run the simulator from dir.
+*/
+void write_workload(const workload& w, const std::filesystem::path& dir, unsigned int seed = 1) {
+    std::filesystem::create_directories(dir);
+    std::mt19937 rng(seed);
+
+    std::vector<std::string> vectors;
+    for(int k = 0; k < WORKLOAD_VECTORS; k++) {
+        std::ostringstream address;
+        address << "0X" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << (0x100 + rng() % 0x700);
+        vectors.push_back(address.str());
+    }
+    std::vector<std::string> delays;
+    for(int k = 0; k < WORKLOAD_DEVICES; k++) {
+        delays.push_back(std::to_string(50 + rng() % 300));
+    }
+
+    std::vector<std::string> external_files;
+    for(const auto& program : w.programs) {
+        external_files.push_back(program.name + "," + std::to_string(program.size));
+        write_lines(dir / (program.name + ".txt"), program.lines);
+    }
+
+    std::vector<unsigned int> layout = w.partitions.empty() ? partition_manager::default_layout() : w.partitions;
+    std::vector<std::string> partitions;
+    for(unsigned int size : layout) {
+        partitions.push_back(std::to_string(size));
+    }
+
+    write_lines(dir / "trace.txt", w.trace);
+    write_lines(dir / "vector_table.txt", vectors);
+    write_lines(dir / "device_table.txt", delays);
+    write_lines(dir / "external_files.txt", external_files);
+    write_lines(dir / "partitions.txt", partitions);
+}
+
+#endif